@@ -26,15 +26,45 @@ SOFTWARE.
 
 // More information, including example code, is found in the file "README.md".
 
+// The server mode and the conversion cache need POSIX and X/Open
+// functionality. On Linux, the server's check of its clients' credentials
+// needs GNU extensions.
+#if (defined(OPTPARSE_SERVER) || defined(OPTPARSE_CONVERSION_CACHE)) \
+    && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 700
+#endif
+#if defined(OPTPARSE_SERVER) && defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "optparse99.h"
 
 #include <assert.h>
-#include <ctype.h>
 #include <errno.h>
 #if OPTPARSE_FLOATING_POINT_SUPPORT
 #include <float.h>
 #endif
 #include <limits.h>
+#if OPTPARSE_DEFERRED_CALLBACKS || OPTPARSE_SUBCOMMANDS
+#include <pthread.h>
+#endif
+#if OPTPARSE_REPL
+#include <setjmp.h>
+#endif
+#if OPTPARSE_SERVER
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+#if OPTPARSE_CONVERSION_CACHE
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#if OPTPARSE_SERVER || OPTPARSE_CONVERSION_CACHE
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -45,32 +75,202 @@ SOFTWARE.
 #include <stdlib.h>
 #include <string.h>
 
+// Thread-local storage: the C11 keyword or the GNU extension.
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 // Global variables
-static struct optparse_cmd *optparse_main_cmd; // The command tree's root.
-static char **args; // Contains the current state of argv while parsing.
-static int args_index; // Keeps track of the currently parsed argument's index.
+static struct optparse_ctx global_ctx; // The parse context used by
+                                       // optparse_parse().
+static THREAD_LOCAL struct optparse_ctx *current_ctx; // The parse context the
+                                                      // calling thread is
+                                                      // parsing with, if any.
+
+#if OPTPARSE_LONG_OPTIONS || OPTPARSE_SUBCOMMANDS || OPTPARSE_SUBOPTIONS
+// A slot of a name table (see below).
+struct name_slot {
+    unsigned long hash;
+    const char *name; // NULL if the slot is empty.
+    void *item;
+};
+
+// An open-addressing hash table (linear probing) that maps names to items.
+// The capacity is always a power of 2 and at least twice the item count.
+struct name_table {
+    struct name_slot *slots;
+    size_t capacity;
+    size_t count;
+};
+#endif
+
+#if OPTPARSE_SUBOPTIONS
+// An option's sub-option lookup index.
+struct optparse_subopt_index {
+    struct name_table keys;
+};
+#endif
+
+// A dynamically growing array of pointers.
+struct ptr_array {
+    void **items;
+    size_t count;
+    size_t capacity;
+};
+
 #if OPTPARSE_SUBCOMMANDS
-static struct optparse_cmd *active_cmd; // Keeps track of the currently running
-                                        // command.
-static int subcmd_depth; // The command tree's depth (automatically calculated).
+// The loading states of a command that has a provider (see load_cmd()).
+enum {
+    PROVIDER_UNLOADED,
+    PROVIDER_LOADING,
+    PROVIDER_LOADED
+};
+
+// Guard the loading states of all commands. Threads that select a command
+// another thread is loading wait for provider_cond.
+static pthread_mutex_t provider_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t provider_cond = PTHREAD_COND_INITIALIZER;
 #endif
-static FILE *help_stream; // The stream help information is printed to.
+
+// A command's lookup index, built once when the command tree is compiled and
+// updated when options or subcommands are added at runtime.
+struct optparse_index {
+    struct ptr_array opts; // All options, in order of appearance.
+    struct optparse_opt *short_opts[UCHAR_MAX + 1]; // Indexed by character.
+#if OPTPARSE_LONG_OPTIONS
+    struct name_table long_opts;
+#endif
+#if OPTPARSE_SUBCOMMANDS
+    struct ptr_array subcmds; // All subcommands, in order of appearance.
+    struct name_table subcmd_names;
+    int provider_state; // PROVIDER_UNLOADED, PROVIDER_LOADING or
+                        // PROVIDER_LOADED.
+#endif
+};
+
+// Holds a single type-converted option-argument.
+union conv_value {
+    char t_char;
+    signed char t_schar;
+    unsigned char t_uchar;
+    short t_shrt;
+    unsigned short t_ushrt;
+    int t_int;
+    unsigned int t_uint;
+    long t_long;
+    unsigned long t_ulong;
+    long long t_llong;
+    unsigned long long t_ullong;
+#if OPTPARSE_FLOATING_POINT_SUPPORT
+    float t_flt;
+    double t_dbl;
+    long double t_ldbl;
+#endif
+    _Bool t_bool;
+#if OPTPARSE_C99_INTEGER_TYPES_SUPPORT
+    int8_t t_int8;
+    uint8_t t_uint8;
+    int16_t t_int16;
+    uint16_t t_uint16;
+    int32_t t_int32;
+    uint32_t t_uint32;
+    int64_t t_int64;
+    uint64_t t_uint64;
+#endif
+};
+
+// Holds the arguments of an option function call.
+struct optparse_call {
+    struct optparse_opt *opt;
+    char *arg;
+    union conv_value conv_arg;
+#if OPTPARSE_LIST_SUPPORT
+    void *list_array;
+    size_t list_size;
+    char *oarg;
+    char **oarg_array;      // The split original option-argument
+    size_t oarg_array_size; // (FUNCTION_TYPE_OARG_ARRAY).
+#endif
+#if OPTPARSE_CONVERSION_CACHE
+    bool list_mapped; // list_array has been mapped from the conversion cache.
+#endif
+};
 
 /// Private functions ----------------------------------------------------------
 
+static void print_help(struct optparse_ctx *ctx, FILE *stream,
+    struct optparse_cmd *cmd, int exit_status, bool noExit);
+#if OPTPARSE_SUBCOMMANDS
+static void load_cmd(struct optparse_cmd *cmd);
+#endif
+
+// Returns the parse context the calling thread is parsing with, so that the
+// functions without a context parameter (e.g. optparse_print_help()) can be
+// called during optparse_parse_r() too. Outside of parsing, the context of the
+// last optparse_parse() is returned.
+static struct optparse_ctx *calling_ctx(void)
+{
+    return current_ctx ? current_ctx : &global_ctx;
+}
+
+// Exits with the specified exit status. If ctx belongs to a running REPL, only
+// the current line's parsing process is ended instead.
+static void quit(struct optparse_ctx *ctx, int exit_status)
+{
+#if OPTPARSE_REPL
+    if (ctx && ctx->_exit_jmp) {
+        longjmp(*(jmp_buf *) ctx->_exit_jmp, 1);
+    }
+#else
+    (void) ctx;
+#endif
+    exit(exit_status);
+}
+
 // Prints an error message and quits. Should be used for parsing errors only.
-static void optparse_error(char *fmt, ...)
+// ctx: the current parse context; NULL if the error is not related to parsing
+static void optparse_error(struct optparse_ctx *ctx, char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
     vfprintf(stderr, fmt, ap);
     va_end(ap);
 #if OPTPARSE_PRINT_HELP_ON_ERROR
-    optparse_fprint_help(stderr, EXIT_FAILURE, false);
+    if (ctx && ctx->_active_cmd) {
+        print_help(ctx, stderr, ctx->_active_cmd, EXIT_FAILURE, false);
+    }
 #endif
-    exit(EXIT_FAILURE);
+    quit(ctx, EXIT_FAILURE);
+}
+
+#if OPTPARSE_COLLECT_ERRORS
+// If the parse context collects errors, stores an error caused by the argument
+// ctx->_args[arg_index] and returns true, so that the caller can skip the
+// argument. Otherwise, returns false.
+static bool collect_error(struct optparse_ctx *ctx,
+    enum optparse_diagnostic_type type, int arg_index)
+{
+    if (ctx == NULL || !ctx->collect_errors) {
+        return false;
+    }
+
+    if (ctx->diagnostic_count < OPTPARSE_DIAGNOSTICS_MAX) {
+        ctx->diagnostics[ctx->diagnostic_count] = (struct optparse_diagnostic) {
+            .type = type,
+            .arg_index = ctx->_args_offset + arg_index,
+        };
+    }
+    ctx->diagnostic_count++;
+    return true;
 }
 
+#define COLLECT_ERROR(ctx, type, arg_index) collect_error(ctx, type, arg_index)
+#else
+#define COLLECT_ERROR(ctx, type, arg_index) false
+#endif
+
 // Safely prints to a buffer of size OPTPARSE_PRINT_BUFFER_SIZE;
 static int bprintf(char *buffer, const char *fmt, ...)
 {
@@ -83,6 +283,290 @@ static int bprintf(char *buffer, const char *fmt, ...)
     return n;
 }
 
+// Appends an item to a pointer array, doubling its capacity if necessary.
+static void ptr_array_append(struct ptr_array *array, void *item)
+{
+    if (array->count == array->capacity) {
+        size_t capacity = array->capacity ? array->capacity * 2 : 8;
+        void **items = realloc(array->items, capacity * sizeof (void *));
+        if (items == NULL) {
+            optparse_error(NULL, "Out of memory.\n");
+        }
+        array->items = items;
+        array->capacity = capacity;
+    }
+    array->items[array->count++] = item;
+}
+
+#if OPTPARSE_REPL
+// The unit arena memory is allocated in; suitably aligned for any data type.
+union arena_unit {
+    long double ld;
+    long long ll;
+    void *p;
+    void (*f)(void);
+};
+
+// A block of arena memory.
+struct arena_block {
+    struct arena_block *next;
+    size_t size; // In units.
+    size_t used; // In units.
+    union arena_unit data[];
+};
+
+// A region allocator whose memory is released all at once.
+struct optparse_arena {
+    struct arena_block *first;
+    struct arena_block *current;
+};
+
+// The minimum number of units an arena block holds.
+#define ARENA_BLOCK_UNITS 512
+
+// Allocates memory from an arena. Returns NULL if out of memory.
+static void *arena_alloc(struct optparse_arena *arena, size_t size)
+{
+    size_t units = (size + sizeof (union arena_unit) - 1)
+        / sizeof (union arena_unit);
+
+    struct arena_block *block = arena->current;
+    while (block && block->size - block->used < units) {
+        if (block->next == NULL) {
+            block = NULL;
+            break;
+        }
+        block = block->next;
+    }
+
+    if (block == NULL) {
+        size_t block_units = units > ARENA_BLOCK_UNITS
+            ? units : ARENA_BLOCK_UNITS;
+        block = malloc(sizeof (struct arena_block)
+            + block_units * sizeof (union arena_unit));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = NULL;
+        block->size = block_units;
+        block->used = 0;
+
+        if (arena->first == NULL) {
+            arena->first = block;
+        } else {
+            struct arena_block *last = arena->current;
+            while (last->next) {
+                last = last->next;
+            }
+            last->next = block;
+        }
+    }
+
+    arena->current = block;
+    void *p = block->data + block->used;
+    block->used += units;
+    return p;
+}
+
+// Makes all of an arena's memory available again, without freeing it.
+static void arena_reset(struct optparse_arena *arena)
+{
+    for (struct arena_block *block = arena->first; block; block = block->next) {
+        block->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+// Frees all of an arena's memory.
+static void arena_free(struct optparse_arena *arena)
+{
+    struct arena_block *block = arena->first;
+    while (block) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
+#endif
+
+#if OPTPARSE_LIST_SUPPORT
+// Allocates memory that is needed while parsing. If the parse context has an
+// arena, the memory is taken from it, otherwise from the heap.
+static void *ctx_alloc(struct optparse_ctx *ctx, size_t size)
+{
+    void *p;
+#if OPTPARSE_REPL
+    if (ctx && ctx->_arena) {
+        p = arena_alloc(ctx->_arena, size);
+    } else
+#endif
+        p = malloc(size);
+
+    if (p == NULL) {
+        optparse_error(ctx, "Out of memory.\n");
+    }
+    return p;
+}
+
+// Frees memory allocated by ctx_alloc(). Arena memory is freed with the arena.
+static void ctx_free(struct optparse_ctx *ctx, void *p)
+{
+#if OPTPARSE_REPL
+    if (ctx && ctx->_arena) {
+        return;
+    }
+#else
+    (void) ctx;
+#endif
+    free(p);
+}
+#endif
+
+// Converts an ASCII upper case letter to lower case (without branching); other
+// characters are returned unchanged.
+static inline unsigned char lower(char c)
+{
+    unsigned char u = c;
+    return u + ((unsigned char) (u - 'A') < 26) * ('a' - 'A');
+}
+
+#if OPTPARSE_LONG_OPTIONS || OPTPARSE_SUBCOMMANDS || OPTPARSE_SUBOPTIONS
+// Returns a name's character as used for hashing and comparison. If
+// OPTPARSE_CASE_INSENSITIVE is true, ASCII upper case letters are folded to
+// lower case.
+static inline unsigned char fold(char c)
+{
+#if OPTPARSE_CASE_INSENSITIVE
+    return lower(c);
+#else
+    return c;
+#endif
+}
+
+// Returns a name's hash value (FNV-1a). If OPTPARSE_CASE_INSENSITIVE is true,
+// the name is case-folded while hashing.
+static unsigned long hash_name(const char *name)
+{
+    unsigned long hash = 2166136261UL;
+    while (*name != '\0') {
+        hash ^= fold(*name++);
+        hash *= 16777619UL;
+    }
+    return hash & 0xFFFFFFFFUL;
+}
+
+// Compares two names, case-folding them if OPTPARSE_CASE_INSENSITIVE is true.
+static bool names_equal(const char *a, const char *b)
+{
+#if OPTPARSE_CASE_INSENSITIVE
+    while (fold(*a) == fold(*b)) {
+        if (*a == '\0') {
+            return true;
+        }
+        a++;
+        b++;
+    }
+    return false;
+#else
+    return strcmp(a, b) == 0;
+#endif
+}
+
+// Returns the slot a name is stored in or would be stored in.
+static struct name_slot *name_table_probe(struct name_table *table,
+    const char *name, unsigned long hash)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+    while (table->slots[i].name != NULL) {
+        if (table->slots[i].hash == hash
+            && names_equal(table->slots[i].name, name)) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &table->slots[i];
+}
+
+// Adds a name to a name table, growing the table if necessary. Names that
+// already exist are not overwritten.
+// Return value: false if the name already existed, otherwise true.
+static bool name_table_insert(struct name_table *table, const char *name,
+    void *item)
+{
+    if ((table->count + 1) * 2 > table->capacity) {
+        struct name_table new_table = {
+            .capacity = table->capacity ? table->capacity * 2 : 8,
+        };
+        new_table.slots = calloc(new_table.capacity, sizeof (struct name_slot));
+        if (new_table.slots == NULL) {
+            optparse_error(NULL, "Out of memory.\n");
+        }
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->slots[i].name) {
+                *name_table_probe(&new_table, table->slots[i].name,
+                    table->slots[i].hash) = table->slots[i];
+            }
+        }
+        new_table.count = table->count;
+        free(table->slots);
+        *table = new_table;
+    }
+
+    unsigned long hash = hash_name(name);
+    struct name_slot *slot = name_table_probe(table, name, hash);
+    if (slot->name) {
+        return false;
+    }
+    slot->hash = hash;
+    slot->name = name;
+    slot->item = item;
+    table->count++;
+    return true;
+}
+
+// Adds a name to a lookup index. Names must be unique within an index; if a
+// name is used twice anyway, it keeps referring to the first item.
+static void index_name(struct name_table *table, const char *name, void *item)
+{
+    bool inserted = name_table_insert(table, name, item);
+    // The name is already used by another option/subcommand/sub-option.
+    assert(inserted);
+    (void) inserted;
+}
+
+#if OPTPARSE_PROFILE && OPTPARSE_LONG_OPTIONS
+// Empties a name table and allocates enough slots for count names, so that
+// inserting them won't trigger a rehash.
+static void name_table_reset(struct name_table *table, size_t count)
+{
+    size_t capacity = 8;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+
+    free(table->slots);
+    table->slots = calloc(capacity, sizeof (struct name_slot));
+    if (table->slots == NULL) {
+        optparse_error(NULL, "Out of memory.\n");
+    }
+    table->capacity = capacity;
+    table->count = 0;
+}
+#endif
+
+// Returns the item stored under a name; NULL if the name is unknown.
+static void *name_table_find(struct name_table *table, const char *name)
+{
+    if (table->count == 0) {
+        return NULL;
+    }
+    return name_table_probe(table, name, hash_name(name))->item;
+}
+#endif
+
 #if OPTPARSE_HELP_USAGE_STYLE == 1
 // Prints an option's usage information ("-a ARG") to a buffer.
 static void bprint_option_usage(char *buffer, struct optparse_opt *opt)
@@ -123,6 +607,9 @@ static int get_data_type_size(enum optparse_data_type data_type)
         case DATA_TYPE_SCHAR:
         case DATA_TYPE_UCHAR:
             return 1;
+        case DATA_TYPE_SHRT:
+        case DATA_TYPE_USHRT:
+            return sizeof (short);
         case DATA_TYPE_INT:
         case DATA_TYPE_UINT:
             return sizeof (int);
@@ -162,16 +649,147 @@ static int get_data_type_size(enum optparse_data_type data_type)
 }
 
 #if OPTPARSE_LIST_SUPPORT
+// Returns the next token of *string, which is delimited by any of the
+// characters in delim, and advances *string past it. Like strtok(), it skips
+// empty tokens and terminates the token in place, but it keeps no hidden state
+// and can be used by several threads at once.
+static char *split_token(char **string, const char *delim)
+{
+    char *token = *string + strspn(*string, delim);
+    if (*token == '\0') {
+        *string = token;
+        return NULL;
+    }
+
+    char *end = token + strcspn(token, delim);
+    *string = *end == '\0' ? end : end + 1;
+    *end = '\0';
+    return token;
+}
+
+// Returns whether a data type is an integer type, which lists can be sorted by
+// (see .arg_sorted).
+static bool is_integer_type(enum optparse_data_type data_type)
+{
+    switch (data_type) {
+        case DATA_TYPE_STR:
+#if OPTPARSE_FLOATING_POINT_SUPPORT
+        case DATA_TYPE_FLT:
+        case DATA_TYPE_DBL:
+        case DATA_TYPE_LDBL:
+#endif
+            return false;
+        default:
+            return get_data_type_size(data_type) != 0;
+    }
+}
+
+// Returns whether an integer data type is signed.
+static bool is_signed_type(enum optparse_data_type data_type)
+{
+    switch (data_type) {
+        case DATA_TYPE_CHAR:
+            return CHAR_MIN < 0;
+        case DATA_TYPE_SCHAR:
+        case DATA_TYPE_SHRT:
+        case DATA_TYPE_INT:
+        case DATA_TYPE_LONG:
+        case DATA_TYPE_LLONG:
+#if OPTPARSE_C99_INTEGER_TYPES_SUPPORT
+        case DATA_TYPE_INT8:
+        case DATA_TYPE_INT16:
+        case DATA_TYPE_INT32:
+        case DATA_TYPE_INT64:
+#endif
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns whether integers are stored least significant byte first.
+static bool is_little_endian(void)
+{
+    const unsigned int one = 1;
+    return *(const unsigned char *) &one;
+}
+
+// Sorts a list of integers in ascending order, using an LSD radix sort that
+// processes one byte per pass. Passes in which all items have the same byte are
+// skipped, so small values in wide types are sorted in few passes.
+static void sort_list(struct optparse_ctx *ctx, void *array, size_t count,
+    enum optparse_data_type data_type)
+{
+    if (count < 2) {
+        return;
+    }
+
+    size_t size = get_data_type_size(data_type);
+    bool little_endian = is_little_endian();
+    unsigned char *src = array;
+    unsigned char *dst = ctx_alloc(ctx, count * size);
+    unsigned char *buffer = dst;
+
+    for (size_t pass = 0; pass < size; pass++) {
+        size_t byte = little_endian ? pass : size - 1 - pass;
+        // Flipping the sign bit makes negative numbers sort first.
+        unsigned char flip = pass == size - 1 && is_signed_type(data_type)
+            ? (UCHAR_MAX >> 1) + 1 : 0;
+
+        size_t offsets[UCHAR_MAX + 1] = { 0 };
+        for (size_t i = 0; i < count; i++) {
+            offsets[src[i * size + byte] ^ flip]++;
+        }
+        if (offsets[src[byte] ^ flip] == count) {
+            continue;
+        }
+        for (size_t i = 0, sum = 0; i <= UCHAR_MAX; i++) {
+            size_t n = offsets[i];
+            offsets[i] = sum;
+            sum += n;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            size_t j = offsets[src[i * size + byte] ^ flip]++;
+            memcpy(dst + j * size, src + i * size, size);
+        }
+        unsigned char *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != array) {
+        memcpy(array, src, count * size);
+    }
+    ctx_free(ctx, buffer);
+}
+
+// Returns an integer list item as a key that sorts like the item's value.
+static unsigned long long get_sort_key(const unsigned char *item, size_t size,
+    bool is_signed, bool little_endian)
+{
+    unsigned long long key = 0;
+    for (size_t i = 0; i < size; i++) {
+        key = key << CHAR_BIT | item[little_endian ? size - 1 - i : i];
+    }
+    if (is_signed) {
+        key ^= 1ULL << (size * CHAR_BIT - 1);
+    }
+    return key;
+}
+
 // Converts a non-literal string that has the form of a list into an array of
 // specified data type. The string will be altered and cannot be used anymore in
 // its original form. The array's data type must match the specified data type.
 // If the list contains items, the array's memory will be dynamically
-// allocated - free() should be called if the memory is no longer needed.
+// allocated - free() should be called if the memory is no longer needed, unless
+// the parse context has an arena the memory has been taken from.
 // To avoid compiler warnings, the array pointer can be explicitly cast to
-// void *: "strtoarr(..., (void *) &array, ...);".
+// void *: "strtoarr(..., (void *) &array, ...);". If sorted is true, the items
+// of an integer list are sorted in ascending order.
 // Return value: the number of list items stored in the array.
-static size_t strtoarr(char *string, void **array, char *delim,
-    enum optparse_data_type data_type)
+static size_t strtoarr(struct optparse_ctx *ctx, char *string, void **array,
+    char *delim, enum optparse_data_type data_type, bool sorted)
 {
     if (string == NULL || delim == NULL) {
         *array = NULL;
@@ -181,48 +799,56 @@ static size_t strtoarr(char *string, void **array, char *delim,
     // Get temporary array size.
     size_t array_size = 1;
     char *c = string;
-    while (*c != '\0') {
-        for (size_t i = 0; i < strlen(delim); i++) {
-            if (*c == delim[i]) {
-                array_size++;
-                break;
-            }
-        }
+    while (*(c += strcspn(c, delim)) != '\0') {
+        array_size++;
         c++;
     }
 
     int data_type_size = get_data_type_size(data_type);
 
     // Allocate temporary array size.
-    *array = malloc(array_size * data_type_size);
-    if (*array == NULL) {
-        optparse_error("Out of memory.\n");
-    }
+    *array = ctx_alloc(ctx, array_size * data_type_size);
 
     // Convert list items to specified data type and store them in the array.
     array_size = 0;
-    char *list_item = strtok(string, delim);
+    char *list_item = split_token(&string, delim);
     while (list_item != NULL) {
         int ret = strtox(list_item, ((char *) *array) + array_size
             * data_type_size, data_type);
         if (ret) {
-            free(*array);
+            ctx_free(ctx, *array);
+            if (COLLECT_ERROR(ctx, ret == 1 ? DIAGNOSTIC_TYPE_INVALID_ARGUMENT
+                    : DIAGNOSTIC_TYPE_OUT_OF_RANGE, ctx->_args_index)) {
+                *array = NULL;
+                return 0;
+            }
             if (ret == 1) {
-                optparse_error("List item not valid: \"%s\"\n", list_item);
+                optparse_error(ctx, "List item not valid: \"%s\"\n", list_item);
             } else if (ret == -1) {
-                optparse_error("List item out of range: \"%s\"\n", list_item);
+                optparse_error(ctx, "List item out of range: \"%s\"\n", list_item);
             }
         }
 
         array_size++;
-        list_item = strtok(NULL, delim);
+        list_item = split_token(&string, delim);
+    }
+
+    if (sorted) {
+        sort_list(ctx, *array, array_size, data_type);
+    }
+
+#if OPTPARSE_REPL
+    // Arena memory can't be shrunk.
+    if (ctx->_arena) {
+        return array_size;
     }
+#endif
 
     // Allocate final array size.
     void *ret = realloc(*array, array_size * data_type_size);
     if (ret == NULL && array_size != 0) {
         free(*array);
-        optparse_error("Out of memory.\n");
+        optparse_error(ctx, "Out of memory.\n");
     } else {
         *array = ret;
     }
@@ -231,1217 +857,3766 @@ static size_t strtoarr(char *string, void **array, char *delim,
 }
 #endif
 
-// Executes an option structure's tasks.
-// arg: the option's option-argument; NULL if none provided by the user.
-static void execute_option(struct optparse_opt *opt, char *arg)
+#if OPTPARSE_CONVERSION_CACHE
+#define CACHE_MAGIC 0x6f707463UL // "optc"
+#define CACHE_VERSION 1
+
+// The header of a conversion cache file. It is followed by the converted
+// array, padded to a multiple of 16 bytes, and by the raw option-argument,
+// which is compared on lookup to rule out hash collisions.
+struct cache_header {
+    unsigned long magic;
+    unsigned long version;
+    unsigned long data_type;
+    unsigned long item_size;
+    unsigned long long hash;
+    size_t item_count;
+    size_t raw_size;
+    size_t array_size;     // Including padding.
+    long double align;     // Aligns the array for all data types.
+};
+
+// Returns the 64-bit FNV-1a hash of a memory block.
+static unsigned long long hash_bytes(const void *p, size_t size,
+    unsigned long long hash)
 {
-    union {
-        char t_char;
-        signed char t_schar;
-        unsigned char t_uchar;
-        short t_shrt;
-        unsigned short t_ushrt;
-        int t_int;
-        unsigned int t_uint;
-        long t_long;
-        unsigned long t_ulong;
-        long long t_llong;
-        unsigned long long t_ullong;
-#if OPTPARSE_FLOATING_POINT_SUPPORT
-        float t_flt;
-        double t_dbl;
-        long double t_ldbl;
-#endif
-        _Bool t_bool;
-#if OPTPARSE_C99_INTEGER_TYPES_SUPPORT
-        int8_t t_int8;
-        uint8_t t_uint8;
-        int16_t t_int16;
-        uint16_t t_uint16;
-        int32_t t_int32;
-        uint32_t t_uint32;
-        int64_t t_int64;
-        uint64_t t_uint64;
-#endif
-    } conv_arg;              // Used to temporarily hold a single type-converted
-                             // option-argument.
-#if OPTPARSE_LIST_SUPPORT
-    void *list_array = NULL; // Used to temporarily or permanently store a
-                             // type-converted list.
-    size_t list_size = 0;    // The converted list's size.
-    char *oarg = arg;        // Optionally used to back up the original
-                             // option-argument.
-#endif
+    const unsigned char *bytes = p;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-    // Set option's flag.
-    if (opt->flag != NULL) {
-        switch (opt->flag_type) {
-            case FLAG_TYPE_SET_TRUE:
-                *(int *) opt->flag = 1;
-                break;
-            case FLAG_TYPE_SET_FALSE:
-                *(int *) opt->flag = 0;
-                break;
-            case FLAG_TYPE_INCREMENT:
-                *(int *) opt->flag += 1;
-                break;
-            case FLAG_TYPE_DECREMENT:
-                *(int *) opt->flag -= 1;
-                break;
-        }
+// Returns the cache key of an option-argument that is converted with the
+// specified delimiters and data type.
+static unsigned long long cache_key(const char *arg, size_t size,
+    const char *delim, enum optparse_data_type data_type, bool sorted)
+{
+    unsigned long header[] = { CACHE_VERSION, data_type,
+        get_data_type_size(data_type), sorted };
+    unsigned long long hash = hash_bytes(header, sizeof header,
+        14695981039346656037ULL);
+    hash = hash_bytes(delim, strlen(delim) + 1, hash);
+    return hash_bytes(arg, size, hash);
+}
+
+// Writes the path of a cache file to a buffer. Returns false if the buffer is
+// too small.
+static bool get_cache_path(char *buffer, size_t size, const char *dir,
+    unsigned long long key, const char *suffix)
+{
+    int len = snprintf(buffer, size, "%s/%016llx%s", dir, key, suffix);
+    return len > 0 && (size_t) len < size;
+}
+
+// Maps the cached conversion of an option-argument into memory.
+// Return value: the array, or NULL if it is not cached.
+static void *cache_lookup(const char *path, const char *arg, size_t raw_size,
+    unsigned long long key, enum optparse_data_type data_type,
+    size_t *item_count)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
     }
 
-    // Type-convert the option-argument.
-    if (arg) {
-#if OPTPARSE_LIST_SUPPORT
-        if (opt->arg_delim) { // Option-argument is a list.
-            // Back up the original option-argument, if necessary.
-            if (opt->function && opt->function_type == FUNCTION_TYPE_OARG) {
-                oarg = malloc(strlen(arg) + 1);
-                if (oarg == NULL) {
-                    optparse_error("Out of memory.\n");
-                }
-                strcpy(oarg, arg);
-            }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size > sizeof (struct
+            cache_header)) {
+        // Mapped privately, so the array can be written to.
+        map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+            0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
 
-            list_size = strtoarr(arg, &list_array, opt->arg_delim,
-                opt->arg_data_type);
-        } else
+    // The file may have been damaged or written by someone else, so check that
+    // the array and the string behind it lie within the file before using them.
+    struct cache_header *header = map;
+    char *array = (char *) map + sizeof (struct cache_header);
+    size_t data_size = (size_t) st.st_size - sizeof (struct cache_header);
+    size_t item_size = get_data_type_size(data_type);
+    if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION
+        || header->data_type != (unsigned long) data_type
+        || header->item_size != item_size
+        || header->hash != key || header->raw_size != raw_size
+        || header->array_size % 16 != 0
+        || header->array_size > data_size
+        || data_size - header->array_size != raw_size
+        || header->item_count > header->array_size / item_size
+        || memcmp(array + header->array_size, arg, raw_size) != 0) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    *item_count = header->item_count;
+    return array;
+}
+
+// Unmaps an array returned by cache_lookup().
+static void cache_unmap(void *array)
+{
+    struct cache_header *header = (struct cache_header *) array - 1;
+    munmap(header, sizeof (struct cache_header) + header->array_size
+        + header->raw_size);
+}
+
+// Records an array mapped from the cache that has been stored in an option's
+// .arg_storage, so that it can be unmapped by release_cache_maps().
+static void keep_cache_map(struct optparse_ctx *ctx, void *array)
+{
+    struct ptr_array maps = {
+        .items = ctx->_cache_maps,
+        .count = ctx->_cache_map_count,
+        .capacity = ctx->_cache_map_capacity,
+    };
+    ptr_array_append(&maps, array);
+    ctx->_cache_maps = maps.items;
+    ctx->_cache_map_count = maps.count;
+    ctx->_cache_map_capacity = maps.capacity;
+}
+
+// Unmaps the arrays recorded by keep_cache_map().
+static void release_cache_maps(struct optparse_ctx *ctx)
+{
+    for (size_t i = 0; i < ctx->_cache_map_count; i++) {
+        cache_unmap(ctx->_cache_maps[i]);
+    }
+    ctx->_cache_map_count = 0;
+}
+
+// Writes a converted option-argument to the cache. The file is written under a
+// temporary name first, so that concurrent readers never see partial files.
+// Errors are ignored, as the cache is only an optimization.
+static void cache_store(const char *dir, const char *path,
+    unsigned long long key, const char *raw, size_t raw_size,
+    enum optparse_data_type data_type, const void *array, size_t item_count)
+{
+    // The temporary name is unique, so that threads and processes storing the
+    // same list at once don't write to the same file.
+    char tmp_path[OPTPARSE_PRINT_BUFFER_SIZE];
+    if (!get_cache_path(tmp_path, sizeof tmp_path, dir, key, ".tmp.XXXXXX")) {
+        return;
+    }
+
+    size_t item_size = get_data_type_size(data_type);
+    struct cache_header header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .data_type = data_type,
+        .item_size = item_size,
+        .hash = key,
+        .item_count = item_count,
+        .raw_size = raw_size,
+        .array_size = (item_count * item_size + 15) / 16 * 16,
+    };
+    static const char padding[16];
+
+    int fd = mkstemp(tmp_path);
+    if (fd == -1) {
+        return;
+    }
+    FILE *file = fdopen(fd, "wb");
+    if (file == NULL) {
+        close(fd);
+        remove(tmp_path);
+        return;
+    }
+    fwrite(&header, sizeof header, 1, file);
+    fwrite(array, item_size, item_count, file);
+    fwrite(padding, 1, header.array_size - item_count * item_size, file);
+    fwrite(raw, 1, raw_size, file);
+    bool failed = ferror(file);
+    if (fclose(file) || failed || rename(tmp_path, path)) {
+        remove(tmp_path);
+    }
+}
+
+// Same as strtoarr(), but looks up the conversion in the parse context's cache
+// directory first and, if not found, stores it there. Only lists of at least
+// OPTPARSE_CONVERSION_CACHE_MIN_SIZE bytes that don't consist of strings are
+// cached. *mapped is set to true if the array has been mapped from the cache.
+static size_t cached_strtoarr(struct optparse_ctx *ctx, char *string,
+    void **array, char *delim, enum optparse_data_type data_type, bool sorted,
+    bool *mapped)
+{
+    *mapped = false;
+    size_t raw_size = string ? strlen(string) : 0;
+    char path[OPTPARSE_PRINT_BUFFER_SIZE];
+    if (ctx->cache_dir == NULL || delim == NULL
+        || raw_size < OPTPARSE_CONVERSION_CACHE_MIN_SIZE
+        || data_type == DATA_TYPE_STR || get_data_type_size(data_type) == 0) {
+        return strtoarr(ctx, string, array, delim, data_type, sorted);
+    }
+
+    unsigned long long key = cache_key(string, raw_size, delim, data_type,
+        sorted);
+    if (!get_cache_path(path, sizeof path, ctx->cache_dir, key, ".bin")) {
+        return strtoarr(ctx, string, array, delim, data_type, sorted);
+    }
+
+    size_t item_count;
+    *array = cache_lookup(path, string, raw_size, key, data_type, &item_count);
+    if (*array) {
+        *mapped = true;
+        return item_count;
+    }
+
+    // strtoarr() alters the string, so keep a copy for the cache file.
+    char *raw = malloc(raw_size);
+    if (raw) {
+        memcpy(raw, string, raw_size);
+    }
+#if OPTPARSE_COLLECT_ERRORS
+    size_t diagnostic_count = ctx->diagnostic_count;
 #endif
-        if (opt->arg_data_type) { // Option-argument is a single value.
-            int ret;
-            ret = strtox(arg, &conv_arg, opt->arg_data_type);
-            if (ret == 1) {
-                optparse_error("Argument not valid: \"%s\"\n", arg);
-            } else if (ret == -1) {
-                optparse_error("Value out of range: \"%s\"\n", arg);
-            }
+    item_count = strtoarr(ctx, string, array, delim, data_type, sorted);
+#if OPTPARSE_COLLECT_ERRORS
+    // Don't cache a list that could not be converted, which would turn it into
+    // a valid, empty one on the next parse.
+    if (ctx->diagnostic_count != diagnostic_count) {
+        free(raw);
+        return item_count;
+    }
+#endif
+    if (raw) {
+        cache_store(ctx->cache_dir, path, key, raw, raw_size, data_type,
+            *array, item_count);
+        free(raw);
+    }
+    return item_count;
+}
+#endif
+
+// Returns the memory location an option's storage member (.arg_storage,
+// .arg_storage_size, .flag or .flag_words) refers to.
+static void *get_storage(struct optparse_ctx *ctx, struct optparse_opt *opt,
+    void *storage)
+{
+    if (storage == NULL || opt->storage_type == STORAGE_TYPE_ABSOLUTE) {
+        return storage;
+    }
+
+    assert(ctx->base != NULL);
+    return (char *) ctx->base + ((size_t) storage - 1);
+}
+
+#if OPTPARSE_CANONICAL_ARGV
+// An option as it occurred on the command line.
+struct optparse_occurrence {
+    struct optparse_cmd *cmd; // The command the option belongs to.
+    struct optparse_opt *opt;
+    char *arg;                // The option-argument; NULL if none or copied.
+    size_t arg_copy;          // If not 0, the option-argument has been copied
+                              // to ctx->_arg_copies, at offset arg_copy - 1.
+    long flag_before;         // The flag's value before the option occurred.
+    size_t seq;               // The option's position on the command line.
+};
+
+// Returns the current value of an option's flag (or bit flag); 0 if none.
+static long get_flag(struct optparse_ctx *ctx, struct optparse_opt *opt)
+{
+    if (opt->flag) {
+        return *(int *) get_storage(ctx, opt, opt->flag);
+    }
+#if OPTPARSE_BIT_FLAGS
+    if (opt->flag_words) {
+        unsigned long *words = get_storage(ctx, opt, opt->flag_words);
+        return OPTPARSE_FLAG_TEST(words, opt->flag_bit);
+    }
+#endif
+    return 0;
+}
+
+// Records an option's occurrence for optparse_canonical_argv().
+static void record_occurrence(struct optparse_ctx *ctx,
+    struct optparse_opt *opt, char *arg)
+{
+    if (ctx->_occurrence_count == ctx->_occurrence_capacity) {
+        size_t capacity = ctx->_occurrence_capacity
+            ? ctx->_occurrence_capacity * 2 : 16;
+        struct optparse_occurrence *occurrences = realloc(ctx->_occurrences,
+            capacity * sizeof (struct optparse_occurrence));
+        if (occurrences == NULL) {
+            optparse_error(ctx, "Out of memory.\n");
         }
+        ctx->_occurrences = occurrences;
+        ctx->_occurrence_capacity = capacity;
+    }
 
-        // Store the (type-converted) option-argument...
-        if (opt->arg_storage) {
+    struct optparse_occurrence *occ =
+        &ctx->_occurrences[ctx->_occurrence_count];
+    *occ = (struct optparse_occurrence) {
+        .cmd = ctx->_active_cmd,
+        .opt = opt,
+        .arg = arg,
+        .flag_before = get_flag(ctx, opt),
+        .seq = ctx->_occurrence_count,
+    };
+    ctx->_occurrence_count++;
+
+#if OPTPARSE_LIST_SUPPORT || OPTPARSE_SUBOPTIONS
+    // Lists and sub-options are split in place, so their original form must be
+    // copied.
+    bool split = false;
 #if OPTPARSE_LIST_SUPPORT
-            if (opt->arg_delim) {
-                *(void **) opt->arg_storage = list_array;
-            } else
+    split = split || opt->arg_delim;
 #endif
-            if (opt->arg_data_type == DATA_TYPE_STR) {
-                *(char **) opt->arg_storage = arg;
-            } else {
-                size_t n = get_data_type_size(opt->arg_data_type);
-                memcpy(opt->arg_storage, &conv_arg, n);
+#if OPTPARSE_SUBOPTIONS
+    split = split || opt->suboptions;
+#endif
+    if (arg && split) {
+        size_t size = strlen(arg) + 1;
+        if (ctx->_arg_copies_size + size > ctx->_arg_copies_capacity) {
+            size_t capacity = ctx->_arg_copies_capacity
+                ? ctx->_arg_copies_capacity : 256;
+            while (capacity < ctx->_arg_copies_size + size) {
+                capacity *= 2;
+            }
+            char *copies = realloc(ctx->_arg_copies, capacity);
+            if (copies == NULL) {
+                optparse_error(ctx, "Out of memory.\n");
             }
+            ctx->_arg_copies = copies;
+            ctx->_arg_copies_capacity = capacity;
         }
+        memcpy(ctx->_arg_copies + ctx->_arg_copies_size, arg, size);
+        occ->arg = NULL;
+        occ->arg_copy = ctx->_arg_copies_size + 1;
+        ctx->_arg_copies_size += size;
     }
+#endif
+}
+#endif
 
+// Calls an option's function with the arguments stored in *call.
+static void call_function(struct optparse_ctx *ctx, struct optparse_call *call)
+{
+    struct optparse_opt *opt = call->opt;
+    char *arg = call->arg;
+    union conv_value conv_arg = call->conv_arg;
 #if OPTPARSE_LIST_SUPPORT
-    // Store the storage size.
-    if (opt->arg_delim && opt->arg_storage_size) {
-        *opt->arg_storage_size = list_size;
-    }
+    void *list_array = call->list_array;
+    size_t list_size = call->list_size;
+    char *oarg = call->oarg;
 #endif
 
-    // Call option's function.
-    if (opt->function) {
-        switch (opt->function_type) {
-            case FUNCTION_TYPE_AUTO:
-                if (opt->arg_name) {
+    switch (opt->function_type) {
+        case FUNCTION_TYPE_AUTO:
+            if (opt->arg_name) {
 #if OPTPARSE_LIST_SUPPORT
-                    if (opt->arg_delim) {
-                        goto type_targ_array;
-                    } else
+                if (opt->arg_delim) {
+                    goto type_targ_array;
+                } else
 #endif
-                    goto type_targ;
-                } else {
-                    goto type_void;
-                }
-            case FUNCTION_TYPE_OARG:
+                goto type_targ;
+            } else {
+                goto type_void;
+            }
+        case FUNCTION_TYPE_OARG:
 #if OPTPARSE_LIST_SUPPORT
-                ((void (*)(char *)) opt->function)(oarg);
+            ((void (*)(char *)) opt->function)(oarg);
 #else
-                ((void (*)(char *)) opt->function)(arg);
+            ((void (*)(char *)) opt->function)(arg);
 #endif
-                break;
-            case FUNCTION_TYPE_TARG:
-                type_targ:
-                switch (opt->arg_data_type) {
-                    case DATA_TYPE_STR:
-                        ((void (*)(char *)) opt->function)(arg);
-                        break;
-                    case DATA_TYPE_CHAR:
-                        ((void (*)(char)) opt->function)(conv_arg.t_char);
-                        break;
-                    case DATA_TYPE_SCHAR:
-                        ((void (*)(signed char)) opt->function)(
-                            conv_arg.t_schar);
-                        break;
-                    case DATA_TYPE_UCHAR:
-                        ((void (*)(unsigned char)) opt->function)(
-                            conv_arg.t_uchar);
-                        break;
-                    case DATA_TYPE_SHRT:
-                        ((void (*)(short)) opt->function)(conv_arg.t_shrt);
-                        break;
-                    case DATA_TYPE_USHRT:
-                        ((void (*)(unsigned short)) opt->function)(
-                            conv_arg.t_ushrt);
-                        break;
-                    case DATA_TYPE_INT:
-                        ((void (*)(int)) opt->function)(conv_arg.t_int);
-                        break;
-                    case DATA_TYPE_UINT:
-                        ((void (*)(unsigned int)) opt->function)(
-                            conv_arg.t_uint);
-                        break;
-                    case DATA_TYPE_LONG:
-                        ((void (*)(long)) opt->function)(conv_arg.t_long);
-                        break;
-                    case DATA_TYPE_ULONG:
-                        ((void (*)(unsigned long)) opt->function)(
-                            conv_arg.t_ulong);
-                        break;
-                    case DATA_TYPE_LLONG:
-                        ((void (*)(long long)) opt->function)(conv_arg.t_llong);
-                        break;
-                    case DATA_TYPE_ULLONG:
-                        ((void (*)(unsigned long long)) opt->function)(
-                            conv_arg.t_ullong);
-                        break;
+            break;
+        case FUNCTION_TYPE_TARG:
+            type_targ:
+            switch (opt->arg_data_type) {
+                case DATA_TYPE_STR:
+                    ((void (*)(char *)) opt->function)(arg);
+                    break;
+                case DATA_TYPE_CHAR:
+                    ((void (*)(char)) opt->function)(conv_arg.t_char);
+                    break;
+                case DATA_TYPE_SCHAR:
+                    ((void (*)(signed char)) opt->function)(
+                        conv_arg.t_schar);
+                    break;
+                case DATA_TYPE_UCHAR:
+                    ((void (*)(unsigned char)) opt->function)(
+                        conv_arg.t_uchar);
+                    break;
+                case DATA_TYPE_SHRT:
+                    ((void (*)(short)) opt->function)(conv_arg.t_shrt);
+                    break;
+                case DATA_TYPE_USHRT:
+                    ((void (*)(unsigned short)) opt->function)(
+                        conv_arg.t_ushrt);
+                    break;
+                case DATA_TYPE_INT:
+                    ((void (*)(int)) opt->function)(conv_arg.t_int);
+                    break;
+                case DATA_TYPE_UINT:
+                    ((void (*)(unsigned int)) opt->function)(
+                        conv_arg.t_uint);
+                    break;
+                case DATA_TYPE_LONG:
+                    ((void (*)(long)) opt->function)(conv_arg.t_long);
+                    break;
+                case DATA_TYPE_ULONG:
+                    ((void (*)(unsigned long)) opt->function)(
+                        conv_arg.t_ulong);
+                    break;
+                case DATA_TYPE_LLONG:
+                    ((void (*)(long long)) opt->function)(conv_arg.t_llong);
+                    break;
+                case DATA_TYPE_ULLONG:
+                    ((void (*)(unsigned long long)) opt->function)(
+                        conv_arg.t_ullong);
+                    break;
 #if OPTPARSE_FLOATING_POINT_SUPPORT
-                    case DATA_TYPE_FLT:
-                        ((void (*)(float)) opt->function)(conv_arg.t_flt);
-                        break;
-                    case DATA_TYPE_DBL:
-                        ((void (*)(double)) opt->function)(conv_arg.t_dbl);
-                        break;
-                    case DATA_TYPE_LDBL:
-                        ((void (*)(long double)) opt->function)(
-                            conv_arg.t_ldbl);
-                        break;
+                case DATA_TYPE_FLT:
+                    ((void (*)(float)) opt->function)(conv_arg.t_flt);
+                    break;
+                case DATA_TYPE_DBL:
+                    ((void (*)(double)) opt->function)(conv_arg.t_dbl);
+                    break;
+                case DATA_TYPE_LDBL:
+                    ((void (*)(long double)) opt->function)(
+                        conv_arg.t_ldbl);
+                    break;
 #endif
-                    case DATA_TYPE_BOOL:
-                        ((void (*)(_Bool)) opt->function)(conv_arg.t_bool);
-                        break;
+                case DATA_TYPE_BOOL:
+                    ((void (*)(_Bool)) opt->function)(conv_arg.t_bool);
+                    break;
 #if OPTPARSE_C99_INTEGER_TYPES_SUPPORT
-                    case DATA_TYPE_INT8:
-                        ((void (*)(int8_t)) opt->function)(conv_arg.t_int8);
-                        break;
-                    case DATA_TYPE_UINT8:
-                        ((void (*)(uint8_t)) opt->function)(conv_arg.t_uint8);
-                        break;
-                    case DATA_TYPE_INT16:
-                        ((void (*)(int16_t)) opt->function)(conv_arg.t_int16);
-                        break;
-                    case DATA_TYPE_UINT16:
-                        ((void (*)(uint16_t)) opt->function)(conv_arg.t_uint16);
-                        break;
-                    case DATA_TYPE_INT32:
-                        ((void (*)(int32_t)) opt->function)(conv_arg.t_int32);
-                        break;
-                    case DATA_TYPE_UINT32:
-                        ((void (*)(uint32_t)) opt->function)(conv_arg.t_uint32);
-                        break;
-                    case DATA_TYPE_INT64:
-                        ((void (*)(int64_t)) opt->function)(conv_arg.t_int64);
-                        break;
-                    case DATA_TYPE_UINT64:
-                        ((void (*)(uint64_t)) opt->function)(conv_arg.t_uint64);
-                        break;
+                case DATA_TYPE_INT8:
+                    ((void (*)(int8_t)) opt->function)(conv_arg.t_int8);
+                    break;
+                case DATA_TYPE_UINT8:
+                    ((void (*)(uint8_t)) opt->function)(conv_arg.t_uint8);
+                    break;
+                case DATA_TYPE_INT16:
+                    ((void (*)(int16_t)) opt->function)(conv_arg.t_int16);
+                    break;
+                case DATA_TYPE_UINT16:
+                    ((void (*)(uint16_t)) opt->function)(conv_arg.t_uint16);
+                    break;
+                case DATA_TYPE_INT32:
+                    ((void (*)(int32_t)) opt->function)(conv_arg.t_int32);
+                    break;
+                case DATA_TYPE_UINT32:
+                    ((void (*)(uint32_t)) opt->function)(conv_arg.t_uint32);
+                    break;
+                case DATA_TYPE_INT64:
+                    ((void (*)(int64_t)) opt->function)(conv_arg.t_int64);
+                    break;
+                case DATA_TYPE_UINT64:
+                    ((void (*)(uint64_t)) opt->function)(conv_arg.t_uint64);
+                    break;
 #endif
-                }
-                break;
+            }
+            break;
 #if OPTPARSE_LIST_SUPPORT
-            case FUNCTION_TYPE_OARG_ARRAY:
-                {
-                    char **array = NULL;
-                    size_t size = strtoarr(oarg, (void *) &array,
-                        opt->arg_delim, DATA_TYPE_STR);
-                    ((void (*)(size_t, char **)) opt->function)(size, array);
-                    if (array) {
-                        free(array);
-                    }
-                }
-                break;
-            case FUNCTION_TYPE_TARG_ARRAY:
-                type_targ_array:
-                switch (opt->arg_data_type) {
-                    case DATA_TYPE_STR:
-                        ((void (*)(size_t, char **)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_CHAR:
-                        ((void (*)(size_t, char *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_SCHAR:
-                        ((void (*)(size_t, signed char *)) opt->function)(
-                            list_size, list_array);
-                        break;
-                    case DATA_TYPE_UCHAR:
-                        ((void (*)(size_t, unsigned char *)) opt->function)(
-                            list_size, list_array);
-                        break;
-                    case DATA_TYPE_SHRT:
-                        ((void (*)(size_t, short *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_USHRT:
-                        ((void (*)(size_t, unsigned short *)) opt->function)(
-                            list_size, list_array);
-                        break;
-                    case DATA_TYPE_INT:
-                        ((void (*)(size_t, int *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_UINT:
-                        ((void (*)(size_t, unsigned int *)) opt->function)(
-                            list_size, list_array);
-                        break;
-                    case DATA_TYPE_LONG:
-                        ((void (*)(size_t, long *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_ULONG:
-                        ((void (*)(size_t, unsigned long *)) opt->function)(
-                            list_size, list_array);
-                        break;
-                    case DATA_TYPE_LLONG:
-                        ((void (*)(size_t, long long *)) opt->function)(
-                            list_size, list_array);
-                        break;
-                    case DATA_TYPE_ULLONG:
-                        ((void (*)(size_t, unsigned long long *)) opt->function)
-                            (list_size, list_array);
-                        break;
+        case FUNCTION_TYPE_OARG_ARRAY:
+            ((void (*)(size_t, char **)) opt->function)(call->oarg_array_size,
+                call->oarg_array);
+            break;
+        case FUNCTION_TYPE_TARG_ARRAY:
+            type_targ_array:
+            switch (opt->arg_data_type) {
+                case DATA_TYPE_STR:
+                    ((void (*)(size_t, char **)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_CHAR:
+                    ((void (*)(size_t, char *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_SCHAR:
+                    ((void (*)(size_t, signed char *)) opt->function)(
+                        list_size, list_array);
+                    break;
+                case DATA_TYPE_UCHAR:
+                    ((void (*)(size_t, unsigned char *)) opt->function)(
+                        list_size, list_array);
+                    break;
+                case DATA_TYPE_SHRT:
+                    ((void (*)(size_t, short *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_USHRT:
+                    ((void (*)(size_t, unsigned short *)) opt->function)(
+                        list_size, list_array);
+                    break;
+                case DATA_TYPE_INT:
+                    ((void (*)(size_t, int *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_UINT:
+                    ((void (*)(size_t, unsigned int *)) opt->function)(
+                        list_size, list_array);
+                    break;
+                case DATA_TYPE_LONG:
+                    ((void (*)(size_t, long *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_ULONG:
+                    ((void (*)(size_t, unsigned long *)) opt->function)(
+                        list_size, list_array);
+                    break;
+                case DATA_TYPE_LLONG:
+                    ((void (*)(size_t, long long *)) opt->function)(
+                        list_size, list_array);
+                    break;
+                case DATA_TYPE_ULLONG:
+                    ((void (*)(size_t, unsigned long long *)) opt->function)
+                        (list_size, list_array);
+                    break;
 #if OPTPARSE_FLOATING_POINT_SUPPORT
-                    case DATA_TYPE_FLT:
-                        ((void (*)(size_t, float *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_DBL:
-                        ((void (*)(size_t, double *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_LDBL:
-                        ((void (*)(size_t, long double *)) opt->function)(
-                            list_size, list_array);
-                        break;
+                case DATA_TYPE_FLT:
+                    ((void (*)(size_t, float *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_DBL:
+                    ((void (*)(size_t, double *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_LDBL:
+                    ((void (*)(size_t, long double *)) opt->function)(
+                        list_size, list_array);
+                    break;
 #endif
-                    case DATA_TYPE_BOOL:
-                        ((void (*)(size_t, _Bool *)) opt->function)(list_size,
-                            list_array);
-                        break;
+                case DATA_TYPE_BOOL:
+                    ((void (*)(size_t, _Bool *)) opt->function)(list_size,
+                        list_array);
+                    break;
 #if OPTPARSE_C99_INTEGER_TYPES_SUPPORT
-                    case DATA_TYPE_INT8:
-                        ((void (*)(size_t, int8_t *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_UINT8:
-                        ((void (*)(size_t, uint8_t *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_INT16:
-                        ((void (*)(size_t, int16_t *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_UINT16:
-                        ((void (*)(size_t, uint16_t *)) opt->function)(
-                            list_size, list_array);
-                        break;
-                    case DATA_TYPE_INT32:
-                        ((void (*)(size_t, int32_t *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_UINT32:
-                        ((void (*)(size_t, uint32_t *)) opt->function)(
-                            list_size, list_array);
-                        break;
-                    case DATA_TYPE_INT64:
-                        ((void (*)(size_t, int64_t *)) opt->function)(list_size,
-                            list_array);
-                        break;
-                    case DATA_TYPE_UINT64:
-                        ((void (*)(size_t, uint64_t *)) opt->function)(
-                            list_size, list_array);
-                        break;
+                case DATA_TYPE_INT8:
+                    ((void (*)(size_t, int8_t *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_UINT8:
+                    ((void (*)(size_t, uint8_t *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_INT16:
+                    ((void (*)(size_t, int16_t *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_UINT16:
+                    ((void (*)(size_t, uint16_t *)) opt->function)(
+                        list_size, list_array);
+                    break;
+                case DATA_TYPE_INT32:
+                    ((void (*)(size_t, int32_t *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_UINT32:
+                    ((void (*)(size_t, uint32_t *)) opt->function)(
+                        list_size, list_array);
+                    break;
+                case DATA_TYPE_INT64:
+                    ((void (*)(size_t, int64_t *)) opt->function)(list_size,
+                        list_array);
+                    break;
+                case DATA_TYPE_UINT64:
+                    ((void (*)(size_t, uint64_t *)) opt->function)(
+                        list_size, list_array);
+                    break;
+#endif
+            }
+            break;
 #endif
+        case FUNCTION_TYPE_VOID:
+            type_void:
+            ((void (*)(void)) opt->function)();
+            break;
+        case FUNCTION_TYPE_CTX_VOID:
+            ((void (*)(struct optparse_ctx *, void *)) opt->function)(ctx,
+                opt->userdata);
+            break;
+        case FUNCTION_TYPE_CTX_TARG:
+            {
+                void *targ = NULL;
+                if (arg) {
+                    targ = opt->arg_data_type == DATA_TYPE_STR
+                        ? (void *) &arg : (void *) &conv_arg;
                 }
-                break;
+                ((void (*)(struct optparse_ctx *, void *, void *))
+                    opt->function)(ctx, opt->userdata, targ);
+            }
+            break;
+        case FUNCTION_TYPE_CTX_OARG:
+#if OPTPARSE_LIST_SUPPORT
+            ((void (*)(struct optparse_ctx *, void *, char *))
+                opt->function)(ctx, opt->userdata, oarg);
+#else
+            ((void (*)(struct optparse_ctx *, void *, char *))
+                opt->function)(ctx, opt->userdata, arg);
+#endif
+            break;
+#if OPTPARSE_LIST_SUPPORT
+        case FUNCTION_TYPE_CTX_TARG_ARRAY:
+            ((void (*)(struct optparse_ctx *, void *, size_t, void *))
+                opt->function)(ctx, opt->userdata, list_size, list_array);
+            break;
 #endif
-            case FUNCTION_TYPE_VOID:
-                type_void:
-                ((void (*)(void)) opt->function)();
-                break;
-        }
     }
+}
 
+// Frees the memory that is no longer needed after an option's function has
+// been called.
+static void free_call(struct optparse_ctx *ctx, struct optparse_call *call)
+{
 #if OPTPARSE_LIST_SUPPORT
-    // List-related clean-up.
-    if (opt->arg_delim && !opt->arg_storage) {
-        free(list_array);
+    if (call->opt->arg_delim && !call->opt->arg_storage) {
+#if OPTPARSE_CONVERSION_CACHE
+        if (call->list_mapped) {
+            cache_unmap(call->list_array);
+        } else
+#endif
+            ctx_free(ctx, call->list_array);
+    }
+    if (call->oarg != call->arg) {
+        ctx_free(ctx, call->oarg);
     }
-    if (oarg != arg) {
-        free(oarg);
+    if (call->oarg_array) {
+        ctx_free(ctx, call->oarg_array);
     }
+#else
+    (void) ctx;
+    (void) call;
 #endif
 }
 
-#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
-// Prints a mutually exclusive option's name ("-o, --option") to a buffer.
-static void bprint_option_name(char *buffer, struct optparse_opt *opt)
+#if OPTPARSE_DEFERRED_CALLBACKS
+// Queues an option's function call to be run after parsing.
+static void defer_call(struct optparse_ctx *ctx, struct optparse_call *call)
 {
-    if (opt->short_name) {
-        bprintf(buffer, "-%c", opt->short_name);
-#if OPTPARSE_LONG_OPTIONS
-        if (opt->long_name) {
-            bprintf(buffer, ", ");
+    if (ctx->_deferred_count == ctx->_deferred_capacity) {
+        size_t capacity = ctx->_deferred_capacity
+            ? ctx->_deferred_capacity * 2 : 8;
+        struct optparse_call *calls = realloc(ctx->_deferred_calls,
+            capacity * sizeof (struct optparse_call));
+        if (calls == NULL) {
+            optparse_error(ctx, "Out of memory.\n");
         }
-#endif
+        ctx->_deferred_calls = calls;
+        ctx->_deferred_capacity = capacity;
     }
+    ctx->_deferred_calls[ctx->_deferred_count++] = *call;
+}
 
-#if OPTPARSE_LONG_OPTIONS
-    if (opt->long_name) {
-        bprintf(buffer, "--%s", opt->long_name);
+// The deferred calls of a single stage, shared by the threads that run them.
+struct stage {
+    struct optparse_ctx *ctx;
+    struct optparse_call **calls;
+    size_t count;
+    size_t next; // The index of the next call to be run.
+    pthread_mutex_t mutex;
+};
+
+// Runs a stage's calls until none are left.
+static void *run_stage(void *arg)
+{
+    struct stage *stage = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&stage->mutex);
+        size_t i = stage->next++;
+        pthread_mutex_unlock(&stage->mutex);
+
+        if (i >= stage->count) {
+            return NULL;
+        }
+        call_function(stage->ctx, stage->calls[i]);
     }
-#endif
 }
 
-// Checks an option for mutual exclusivity violations and quits on error.
-static void check_mutual_exclusivity(struct optparse_opt *opt)
+// Runs all deferred calls, stage by stage, and frees them.
+static void run_deferred_calls(struct optparse_ctx *ctx)
 {
-    static struct optparse_opt *exclusive_opts[OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX];
+    if (ctx->_deferred_count == 0) {
+        return;
+    }
 
-    if (opt->group > 0 && opt->group
-            < OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX) {
-        if (exclusive_opts[opt->group]) {
-            char buffer1[OPTPARSE_PRINT_BUFFER_SIZE];
-            buffer1[0] = '\0';
-            char buffer2[OPTPARSE_PRINT_BUFFER_SIZE];
-            buffer2[0] = '\0';
-            bprint_option_name(buffer1, exclusive_opts[opt->group]);
-            bprint_option_name(buffer2, opt);
-            optparse_error("Options %s and %s are mutually exclusive.\n",
-                buffer1, buffer2);
+    struct optparse_call **calls = malloc(ctx->_deferred_count
+        * sizeof (struct optparse_call *));
+    if (calls == NULL) {
+        optparse_error(ctx, "Out of memory.\n");
+    }
+
+    int stage_number = 0;
+    for (;;) {
+        // Find the next stage.
+        int next_stage_number = INT_MAX;
+        for (size_t i = 0; i < ctx->_deferred_count; i++) {
+            int n = ctx->_deferred_calls[i].opt->deferred;
+            if (n > stage_number && n < next_stage_number) {
+                next_stage_number = n;
+            }
+        }
+        if (next_stage_number == INT_MAX) {
+            break;
+        }
+        stage_number = next_stage_number;
+
+        struct stage stage = {
+            .ctx = ctx,
+            .calls = calls,
+            .mutex = PTHREAD_MUTEX_INITIALIZER,
+        };
+        for (size_t i = 0; i < ctx->_deferred_count; i++) {
+            if (ctx->_deferred_calls[i].opt->deferred == stage_number) {
+                calls[stage.count++] = &ctx->_deferred_calls[i];
+            }
+        }
+
+        // The current thread takes part in running the stage; if threads can't
+        // be created, it runs the remaining calls alone.
+        pthread_t threads[OPTPARSE_DEFERRED_THREADS_MAX];
+        size_t thread_count = 0;
+        while (thread_count + 1 < stage.count
+                && thread_count + 1 < OPTPARSE_DEFERRED_THREADS_MAX) {
+            if (pthread_create(&threads[thread_count], NULL, run_stage,
+                    &stage)) {
+                break;
+            }
+            thread_count++;
+        }
+        run_stage(&stage);
+        for (size_t i = 0; i < thread_count; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&stage.mutex);
+    }
+
+    for (size_t i = 0; i < ctx->_deferred_count; i++) {
+        free_call(ctx, &ctx->_deferred_calls[i]);
+    }
+    free(calls);
+    free(ctx->_deferred_calls);
+    ctx->_deferred_calls = NULL;
+    ctx->_deferred_count = 0;
+    ctx->_deferred_capacity = 0;
+}
+
+#if OPTPARSE_REPL || OPTPARSE_COLLECT_ERRORS
+// Frees the deferred calls of a parsing process that has been ended early.
+static void discard_deferred_calls(struct optparse_ctx *ctx)
+{
+    for (size_t i = 0; i < ctx->_deferred_count; i++) {
+        free_call(ctx, &ctx->_deferred_calls[i]);
+    }
+    free(ctx->_deferred_calls);
+    ctx->_deferred_calls = NULL;
+    ctx->_deferred_count = 0;
+    ctx->_deferred_capacity = 0;
+}
+#endif
+#endif
+
+#if OPTPARSE_SUBOPTIONS
+// Splits an option-argument in place into comma-separated keys and values and
+// stores them as specified by the option's sub-options.
+static void parse_suboptions(struct optparse_ctx *ctx, struct optparse_opt *opt,
+    char *arg)
+{
+    char *item = arg;
+    while (item) {
+        char *next = strchr(item, ',');
+        if (next) {
+            *next++ = '\0';
+        }
+        char *value = strchr(item, '=');
+        if (value) {
+            *value++ = '\0';
+        }
+
+        struct optparse_subopt *subopt = name_table_find(
+            &opt->_subopt_index->keys, item);
+        if (subopt == NULL) {
+            if (!COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_UNKNOWN_OPTION,
+                    ctx->_args_index)) {
+                optparse_error(ctx, "Unknown key: \"%s\"\n", item);
+            }
+        } else if (value && !subopt->storage) {
+            if (!COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_UNWANTED_ARGUMENT,
+                    ctx->_args_index)) {
+                optparse_error(ctx, "Unwanted value for key \"%s\": \"%s\"\n",
+                    item, value);
+            }
+        } else if (!value && !subopt->flag) {
+            if (!COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_MISSING_ARGUMENT,
+                    ctx->_args_index)) {
+                optparse_error(ctx, "Key \"%s\" requires a value.\n", item);
+            }
         } else {
-            exclusive_opts[opt->group] = opt;
+            int ret = 0;
+            if (value && subopt->data_type == DATA_TYPE_STR) {
+                *(char **) get_storage(ctx, opt, subopt->storage) = value;
+            } else if (value) {
+                ret = strtox(value, get_storage(ctx, opt, subopt->storage),
+                    subopt->data_type);
+            }
+
+            if (ret == 1) {
+                if (!COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_INVALID_ARGUMENT,
+                        ctx->_args_index)) {
+                    optparse_error(ctx, "Value of key \"%s\" not valid: \"%s\"\n",
+                        item, value);
+                }
+            } else if (ret == -1) {
+                if (!COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_OUT_OF_RANGE,
+                        ctx->_args_index)) {
+                    optparse_error(ctx, "Value of key \"%s\" out of range: "
+                        "\"%s\"\n", item, value);
+                }
+            } else if (subopt->flag) {
+                *(int *) get_storage(ctx, opt, subopt->flag) = 1;
+            }
+        }
+
+        item = next;
+    }
+}
+#endif
+
+// Executes an option structure's tasks.
+// arg: the option's option-argument; NULL if none provided by the user.
+static void execute_option(struct optparse_ctx *ctx, struct optparse_opt *opt,
+    char *arg)
+{
+    union conv_value conv_arg; // Used to temporarily hold a single
+                               // type-converted option-argument.
+#if OPTPARSE_LIST_SUPPORT
+    void *list_array = NULL; // Used to temporarily or permanently store a
+                             // type-converted list.
+    size_t list_size = 0;    // The converted list's size.
+    char *oarg = arg;        // Optionally used to back up the original
+                             // option-argument.
+#endif
+#if OPTPARSE_CONVERSION_CACHE
+    bool list_mapped = false;
+#endif
+#if OPTPARSE_COLLECT_ERRORS
+    size_t diagnostic_count = ctx->diagnostic_count;
+#endif
+
+#if OPTPARSE_PROFILE
+    // Parses of a shared command tree may run in several threads at once.
+#if defined(__GNUC__)
+    __atomic_fetch_add(&opt->_hits, 1, __ATOMIC_RELAXED);
+#else
+    opt->_hits++;
+#endif
+#endif
+#if OPTPARSE_CANONICAL_ARGV
+    record_occurrence(ctx, opt, arg);
+#endif
+
+    void *arg_storage = get_storage(ctx, opt, opt->arg_storage);
+    int *flag = get_storage(ctx, opt, opt->flag);
+
+    // Set option's flag.
+    if (flag != NULL) {
+        switch (opt->flag_type) {
+            case FLAG_TYPE_SET_TRUE:
+                *flag = 1;
+                break;
+            case FLAG_TYPE_SET_FALSE:
+                *flag = 0;
+                break;
+            case FLAG_TYPE_INCREMENT:
+                *flag += 1;
+                break;
+            case FLAG_TYPE_DECREMENT:
+                *flag -= 1;
+                break;
+            case FLAG_TYPE_TOGGLE:
+                *flag = !*flag;
+                break;
+        }
+    }
+
+#if OPTPARSE_BIT_FLAGS
+    // Set option's bit flag.
+    if (opt->flag_words != NULL) {
+        unsigned long *word = (unsigned long *) get_storage(ctx, opt,
+            opt->flag_words) + opt->flag_bit / OPTPARSE_FLAG_WORD_BITS;
+        unsigned long mask = 1UL << opt->flag_bit % OPTPARSE_FLAG_WORD_BITS;
+        switch (opt->flag_type) {
+            case FLAG_TYPE_SET_TRUE:
+                *word |= mask;
+                break;
+            case FLAG_TYPE_SET_FALSE:
+                *word &= ~mask;
+                break;
+            case FLAG_TYPE_TOGGLE:
+                *word ^= mask;
+                break;
+            default:
+                break;
+        }
+    }
+#endif
+
+    // Type-convert the option-argument.
+    if (arg) {
+#if OPTPARSE_SUBOPTIONS
+        if (opt->suboptions) {
+            parse_suboptions(ctx, opt, arg);
+        } else
+#endif
+#if OPTPARSE_LIST_SUPPORT
+        if (opt->arg_delim) { // Option-argument is a list.
+            // Back up the original option-argument, if necessary.
+            if (opt->function && (opt->function_type == FUNCTION_TYPE_OARG
+                    || opt->function_type == FUNCTION_TYPE_CTX_OARG
+                    || opt->function_type == FUNCTION_TYPE_OARG_ARRAY)) {
+                oarg = ctx_alloc(ctx, strlen(arg) + 1);
+                strcpy(oarg, arg);
+            }
+
+#if OPTPARSE_CONVERSION_CACHE
+            list_size = cached_strtoarr(ctx, arg, &list_array, opt->arg_delim,
+                opt->arg_data_type, opt->arg_sorted, &list_mapped);
+#else
+            list_size = strtoarr(ctx, arg, &list_array, opt->arg_delim,
+                opt->arg_data_type, opt->arg_sorted);
+#endif
+        } else
+#endif
+        if (opt->arg_data_type) { // Option-argument is a single value.
+            int ret;
+            ret = strtox(arg, &conv_arg, opt->arg_data_type);
+            if (ret == 1) {
+                if (!COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_INVALID_ARGUMENT,
+                        ctx->_args_index)) {
+                    optparse_error(ctx, "Argument not valid: \"%s\"\n", arg);
+                }
+            } else if (ret == -1) {
+                if (!COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_OUT_OF_RANGE,
+                        ctx->_args_index)) {
+                    optparse_error(ctx, "Value out of range: \"%s\"\n", arg);
+                }
+            }
+        }
+
+#if OPTPARSE_COLLECT_ERRORS
+        // Skip the option if its option-argument could not be converted.
+        if (ctx->diagnostic_count != diagnostic_count) {
+#if OPTPARSE_LIST_SUPPORT
+            if (oarg != arg) {
+                ctx_free(ctx, oarg);
+            }
+#endif
+            return;
+        }
+#endif
+
+        // Store the (type-converted) option-argument...
+        if (arg_storage) {
+#if OPTPARSE_LIST_SUPPORT
+            if (opt->arg_delim) {
+                *(void **) arg_storage = list_array;
+#if OPTPARSE_CONVERSION_CACHE
+                if (list_mapped) {
+                    keep_cache_map(ctx, list_array);
+                }
+#endif
+            } else
+#endif
+            if (opt->arg_data_type == DATA_TYPE_STR) {
+                *(char **) arg_storage = arg;
+            } else {
+                size_t n = get_data_type_size(opt->arg_data_type);
+                memcpy(arg_storage, &conv_arg, n);
+            }
+        }
+    }
+
+#if OPTPARSE_LIST_SUPPORT
+    // Store the storage size.
+    if (opt->arg_delim && opt->arg_storage_size) {
+        *(size_t *) get_storage(ctx, opt, opt->arg_storage_size) = list_size;
+    }
+#endif
+
+    struct optparse_call call = {
+        .opt = opt,
+        .arg = arg,
+        .conv_arg = conv_arg,
+#if OPTPARSE_LIST_SUPPORT
+        .list_array = list_array,
+        .list_size = list_size,
+        .oarg = oarg,
+#endif
+#if OPTPARSE_CONVERSION_CACHE
+        .list_mapped = list_mapped,
+#endif
+    };
+
+#if OPTPARSE_LIST_SUPPORT
+    // Split the original option-argument now rather than in call_function():
+    // deferred functions run on other threads, which must neither allocate
+    // from the parse context nor run into errors.
+    if (opt->function && opt->function_type == FUNCTION_TYPE_OARG_ARRAY) {
+        call.oarg_array_size = strtoarr(ctx, oarg, (void *) &call.oarg_array,
+            opt->arg_delim, DATA_TYPE_STR, false);
+    }
+#endif
+
+    // Call option's function.
+    if (opt->function) {
+#if OPTPARSE_DEFERRED_CALLBACKS
+        if (opt->deferred > 0) {
+            defer_call(ctx, &call);
+            return;
+        }
+#endif
+        call_function(ctx, &call);
+    }
+
+    free_call(ctx, &call);
+}
+
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+// Prints a mutually exclusive option's name ("-o, --option") to a buffer.
+static void bprint_option_name(char *buffer, struct optparse_opt *opt)
+{
+    if (opt->short_name) {
+        bprintf(buffer, "-%c", opt->short_name);
+#if OPTPARSE_LONG_OPTIONS
+        if (opt->long_name) {
+            bprintf(buffer, ", ");
+        }
+#endif
+    }
+
+#if OPTPARSE_LONG_OPTIONS
+    if (opt->long_name) {
+        bprintf(buffer, "--%s", opt->long_name);
+    }
+#endif
+}
+
+// Checks an option for mutual exclusivity violations and quits on error.
+// Return value: false if the error has been collected instead
+static bool check_mutual_exclusivity(struct optparse_ctx *ctx,
+    struct optparse_opt *opt)
+{
+    struct optparse_opt **exclusive_opts = ctx->_exclusive_opts;
+
+    if (opt->group > 0 && opt->group
+            < OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX) {
+        if (exclusive_opts[opt->group]) {
+            char buffer1[OPTPARSE_PRINT_BUFFER_SIZE];
+            buffer1[0] = '\0';
+            char buffer2[OPTPARSE_PRINT_BUFFER_SIZE];
+            buffer2[0] = '\0';
+            if (COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_MUTUALLY_EXCLUSIVE,
+                    ctx->_args_index)) {
+                return false;
+            }
+            bprint_option_name(buffer1, exclusive_opts[opt->group]);
+            bprint_option_name(buffer2, opt);
+            optparse_error(ctx, "Options %s and %s are mutually exclusive.\n",
+                buffer1, buffer2);
+        } else {
+            exclusive_opts[opt->group] = opt;
+        }
+    }
+
+    return true;
+}
+#endif
+
+#if OPTPARSE_LONG_OPTIONS
+// Identifies and executes a single known long option.
+static void execute_long_option(struct optparse_ctx *ctx, char *long_name,
+    struct optparse_cmd *cmd)
+{
+#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
+    char *arg = strchr(long_name, '=');
+    if (arg) {
+        *arg++ = '\0';
+    }
+#else
+    char *arg = NULL;
+#endif
+
+    struct optparse_opt *opt = name_table_find(&cmd->_index->long_opts,
+        long_name);
+    if (opt == NULL) {
+        if (COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_UNKNOWN_OPTION,
+                ctx->_args_index)) {
+            return;
+        }
+        optparse_error(ctx, "Unknown option: \"--%s\"\n", long_name);
+    }
+
+    bool valid = true;
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+    valid = check_mutual_exclusivity(ctx, opt);
+#endif
+    if (arg) {
+        if (!opt->arg_name) {
+            if (COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_UNWANTED_ARGUMENT,
+                    ctx->_args_index)) {
+                return;
+            }
+            optparse_error(ctx, "Unwanted option-argument: \"%s\"\n", arg);
+        }
+    } else if (opt->arg_name && opt->arg_name[0] != '[') {
+        arg = optparse_shift_r(ctx);
+        if (arg == NULL) {
+            if (COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_MISSING_ARGUMENT,
+                    ctx->_args_index - 1)) {
+                return;
+            }
+            optparse_error(ctx, "Option \"--%s\" requires an argument.\n",
+                long_name);
+        }
+    }
+
+    if (valid) {
+        execute_option(ctx, opt, arg);
+    }
+}
+#endif
+
+// Identifies and executes a group of known short options.
+// option_group must not be NULL.
+static void execute_short_option(struct optparse_ctx *ctx, char *option_group,
+    struct optparse_cmd *cmd)
+{
+    char *c = option_group + 1;
+
+    while (*c != '\0') {
+        char *arg = c + 1;
+        if (*arg == '\0') {
+            arg = NULL;
+        }
+
+        struct optparse_opt *opt = cmd->_index->short_opts[(unsigned char) *c];
+        if (opt == NULL) {
+            if (COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_UNKNOWN_OPTION,
+                    ctx->_args_index)) {
+                c++;
+                continue;
+            }
+            if (option_group[1] != '\0' && option_group[2] != '\0') {
+                optparse_error(ctx,
+                    "Unknown option: \"-%c\" (in sequence \"%s\")\n", *c,
+                    option_group);
+            } else {
+                optparse_error(ctx, "Unknown option: \"%s\"\n", option_group);
+            }
+        }
+
+        bool valid = true;
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+        valid = check_mutual_exclusivity(ctx, opt);
+#endif
+        if (arg) {
+#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
+            if (!opt->arg_name) {
+                arg = NULL;
+            }
+#else
+            if (opt->arg_name) {
+                if (COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_MISSING_ARGUMENT,
+                        ctx->_args_index)) {
+                    return;
+                }
+                optparse_error(ctx, "Option -%c (in sequence \"%s\")"
+                    " requires an argument.\n", *c, option_group);
+            } else {
+                arg = NULL;
+            }
+#endif
+        } else if (opt->arg_name && opt->arg_name[0] != '[') {
+            arg = optparse_shift_r(ctx);
+            if (arg == NULL) {
+                if (COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_MISSING_ARGUMENT,
+                        ctx->_args_index - 1)) {
+                    return;
+                }
+                optparse_error(ctx, "Option -%c requires an argument.\n", *c);
+            }
+        }
+
+        if (valid) {
+            execute_option(ctx, opt, arg);
+        }
+        if (arg) {
+            return;
+        }
+
+        c++;
+    }
+}
+
+// Ends parsing by turning the remaining arguments, starting with
+// ctx->_args[start], into the operands, without copying them: argv[0] is moved
+// to the slot before them, which has already been parsed.
+static void hand_over_tail(struct optparse_ctx *ctx, int *argc, char ***argv,
+    int start)
+{
+    ctx->_args[start - 1] = ctx->_args[0];
+    *argv = ctx->_args + start - 1;
+    *argc = ctx->_args_count - start + 1;
+
+    ctx->_args = *argv;
+    ctx->_args_index = *argc;
+    ctx->_args_count = *argc;
+}
+
+// Parses a command's command line options.
+// After parsing, only operands remain in argv.
+static void parse(struct optparse_ctx *ctx, int *argc, char ***argv,
+    struct optparse_cmd *cmd)
+{
+    char **args = *argv;
+    ctx->_args = args;
+    ctx->_args_index = 1;
+    ctx->_args_count = *argc;
+    *argc = 1; // To keep argv[0].
+    ctx->_active_cmd = cmd;
+#if OPTPARSE_SUBCOMMANDS
+    load_cmd(cmd);
+#endif
+
+    bool stop_at_operand = cmd->stop_at_operand;
+#if OPTPARSE_SUBCOMMANDS
+    stop_at_operand = stop_at_operand && !cmd->_index->subcmds.count;
+#endif
+
+    int ignore_options = 0;
+    while (ctx->_args_index < ctx->_args_count) {
+        char *arg = args[ctx->_args_index];
+        if (!ignore_options && arg[0] == '-') { // Option
+            if (arg[1] == '-') {
+                if (arg[2] == '\0') { // Stand-alone option "--"
+                    if (stop_at_operand) {
+                        hand_over_tail(ctx, argc, argv, ctx->_args_index + 1);
+                        break;
+                    }
+                    ignore_options = 1;
+#if OPTPARSE_LONG_OPTIONS
+                } else { // Long option
+                    execute_long_option(ctx, arg + 2, cmd);
+#endif
+                }
+            } else { // Short option
+                execute_short_option(ctx, arg, cmd);
+            }
+        } else { // Operand or subcommand
+#if OPTPARSE_SUBCOMMANDS
+            if (cmd->_index->subcmds.count) {
+                struct optparse_cmd *subcmd = name_table_find(
+                    &cmd->_index->subcmd_names, arg);
+                if (subcmd) {
+#if OPTPARSE_COLLECT_ERRORS
+                    ctx->_args_offset += ctx->_args_index;
+#endif
+                    // Remove previous arguments, including the subcommand,
+                    // from argv (args will be set in the next iteration).
+                    while (++ctx->_args_index < ctx->_args_count) {
+                        (*argv)[(*argc)++] = args[ctx->_args_index];
+                    }
+
+                    // Continue parsing with the subcommand.
+                    parse(ctx, argc, argv, subcmd);
+
+                    return;
+                } else if (!COLLECT_ERROR(ctx, DIAGNOSTIC_TYPE_UNKNOWN_COMMAND,
+                        ctx->_args_index)) {
+                    optparse_error(ctx, "Unknown command: \"%s\"\n", arg);
+                }
+            } else
+#endif
+            if (stop_at_operand) {
+                hand_over_tail(ctx, argc, argv, ctx->_args_index);
+                break;
+            } else {
+                // Treat argument as an operand, adding it to the new argv.
+                (*argv)[(*argc)++] = arg;
+            }
+        }
+
+        // Can be past the end due to optparse_shift().
+        if (ctx->_args_index < ctx->_args_count) {
+            ctx->_args_index++;
+        }
+    }
+
+    // Only terminate argv if that doesn't write past the parsed window, which
+    // may be a slice of a larger array. Subcommands parse a part of the window,
+    // so _args_count can't be used.
+    if (*argv + *argc < ctx->_args_end) {
+        (*argv)[*argc] = NULL;
+    }
+
+#if OPTPARSE_CANONICAL_ARGV
+    ctx->_operands = *argv;
+    ctx->_operand_count = *argc;
+#endif
+
+#if OPTPARSE_COLLECT_ERRORS
+    // Don't run the command with an invalid command line.
+    if (ctx->diagnostic_count) {
+#if OPTPARSE_DEFERRED_CALLBACKS
+        discard_deferred_calls(ctx);
+#endif
+        return;
+    }
+#endif
+
+#if OPTPARSE_DEFERRED_CALLBACKS
+    // Run deferred option functions before the command's function.
+    run_deferred_calls(ctx);
+#endif
+
+    // Run command's function on remaining operands.
+    ctx->_args = *argv;
+    ctx->_args_count = *argc;
+    if (cmd->function) {
+        ctx->_args_index = 0;
+        cmd->function(*argc, *argv);
+    } else if (cmd->ctx_function) {
+        ctx->_args_index = 0;
+        cmd->ctx_function(ctx, cmd->userdata, *argc, *argv);
+    }
+}
+
+/// Private "help screen" functions --------------------------------------------
+
+// Prints a string using automatic word-wrapping.
+// stream: the stream the string will be printed to
+// str: the string to be printed
+// first_line_indent: the known column at which printing starts
+// indent: the indentation width (starting from line 2)
+static void blockprint(FILE *stream, char *str, int first_line_indent,
+    int indent, int end)
+{
+#if OPTPARSE_HELP_WORD_WRAP
+    if (str == NULL || str[0] == '\0') {
+        fputc('\n', stream);
+        return;
+    }
+
+    int first_line_printed = 0;
+    int width = end - indent;
+
+    while (1) {
+        // Indentation
+        if (first_line_printed) {
+            fprintf(stream, "%*s", indent, "");
+        } else {
+            if (first_line_indent > end) {
+                // Indentation exceeds block width
+                // Intentionally break into new line
+                width = 0;
+            } else {
+                // Indentation does not exceed block width
+                width = end - first_line_indent;
+            }
+        }
+
+        int n = 0; // Number of characters to be printed on the current line
+
+        while (n <= width) {
+            // Print early when encountering a newline character.
+            if (str[n] == '\n') {
+                fprintf(stream, "%.*s", ++n, str);
+                str += n;
+                goto next;
+            }
+            // Print and finish if string is shorter than width.
+            if (str[n] == '\0') {
+                fprintf(stream, "%s\n", str);
+                return;
+            }
+            n++;
+        } // If this loop survives, word-wrapping will happen.
+        n--;
+
+        // First make sure not to truncate the last word...
+        while (n > 0 && str[n] != ' ') {
+            n--;
+        }
+
+        // ...then make sure not to print any trailing spaces.
+        while (n > 0 && str[n - 1] == ' ') {
+            n--;
+        }
+
+        // Truncate if the string is too long.
+        if (n == 0) {
+            n = width;
+        }
+
+        fprintf(stream, "%.*s\n", n, str);
+        str += n;
+
+        // Remove word-separating leading space before printing the next line.
+        if (str[0] == ' ') {
+            str++;
+        }
+
+        next:
+        if (first_line_printed == 0) {
+            first_line_printed = 1;
+            width = end - indent;
+        }
+    }
+#else
+    fprintf(stream, "%s\n", str);
+#endif
+}
+
+
+#if OPTPARSE_SUBCOMMANDS
+// Prints the names of a command's parents, including the root command, and the
+// command itself to a buffer, in the order in which they appear in the command
+// tree.
+static void bprint_cmd_chain(char *buffer, struct optparse_cmd *cmd)
+{
+    if (cmd->_parent) {
+        bprint_cmd_chain(buffer, cmd->_parent);
+    }
+    bprintf(buffer, " %s", cmd->name);
+}
+#endif
+
+#if OPTPARSE_HELP_USAGE_STYLE == 1 && OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+// Prints all of a specified group's mutually exlusive options to a buffer.
+// Assumes there are at least 2 group members.
+// options: the command's options
+// i: the index of the group's first option
+static void bprint_exclusive_option_group(char *buffer,
+    struct ptr_array *options, size_t i, int *printed_groups)
+{
+    struct optparse_opt *opt = options->items[i];
+    int group_index = opt->group;
+
+    // Don't print groups that have already been printed.
+    if (printed_groups[group_index]) {
+        return;
+    }
+
+    bprintf(buffer, " [");
+    bprint_option_usage(buffer, opt);
+
+    while (++i < options->count) {
+        opt = options->items[i];
+        if (opt->group == group_index) {
+            bprintf(buffer, "|");
+            bprint_option_usage(buffer, opt);
+        }
+    }
+
+    bprintf(buffer, "]");
+    printed_groups[group_index] = 1; // Mark group as printed.
+}
+#endif
+
+// Prints a command's usage.
+static void print_usage(FILE *stream, struct optparse_cmd *cmd)
+{
+#if OPTPARSE_HELP_LETTER_CASE == 0
+    fprintf(stream, "Usage:");
+#elif OPTPARSE_HELP_LETTER_CASE == 1
+    fprintf(stream, "usage:");
+#elif OPTPARSE_HELP_LETTER_CASE == 2
+    fprintf(stream, "USAGE:");
+#endif
+
+    char buffer[OPTPARSE_PRINT_BUFFER_SIZE];
+    buffer[0] = '\0';
+
+    // If a custom usage string is provided, print it and return.
+    if (cmd->usage) {
+        bprintf(buffer, " %s\n", cmd->usage);
+        goto print;
+    }
+
+    // Print command name(s).
+#if OPTPARSE_SUBCOMMANDS
+    bprint_cmd_chain(buffer, cmd);
+#else
+    bprintf(buffer, " %s", cmd->name);
+#endif
+
+    // Print command's options.
+    if (cmd->_index->opts.count) {
+#if OPTPARSE_HELP_USAGE_STYLE == 1
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+        int printed_groups[OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX] = { 0 };
+#endif
+
+        for (size_t i = 0; i < cmd->_index->opts.count; i++) {
+            struct optparse_opt *opt = cmd->_index->opts.items[i];
+#if OPTPARSE_HIDDEN_OPTIONS
+            // Don't print options marked as "hidden".
+            if (opt->hidden) {
+                continue;
+            }
+#endif
+
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+            if (opt->group) {
+                bprint_exclusive_option_group(buffer, &cmd->_index->opts, i,
+                    printed_groups);
+            } else
+#endif
+            {
+                bprintf(buffer, " [");
+                bprint_option_usage(buffer, opt);
+                bprintf(buffer, "]");
+            }
+        }
+#else
+        bprintf(buffer, " [" OPTPARSE_HELP_USAGE_OPTIONS_STRING "]");
+#endif
+    }
+
+    // Print command's operands.
+    if (cmd->operands) {
+        bprintf(buffer, " %s", cmd->operands);
+    }
+
+    print:
+    blockprint(stream, buffer, 7, 7, OPTPARSE_HELP_MAX_LINE_WIDTH);
+}
+
+// Prints a set of options (names, arguments, descriptions).
+static void print_options(FILE *stream, struct ptr_array *options)
+{
+    int divider_width = 0;
+
+    // Determine divider width -------------------------------------------------
+    // (see section "Print" below to know where the numbers come from)
+    for (size_t i = 0; i < options->count; i++) {
+        struct optparse_opt *opt = options->items[i];
+#if OPTPARSE_HIDDEN_OPTIONS
+        if (opt->hidden) {
+            continue;
+        }
+#endif
+
+        int len = OPTPARSE_HELP_INDENTATION_WIDTH * 2;
+
+        if (opt->short_name) {
+            len += 2;
+#if OPTPARSE_OPTION_ALIASES
+            if (opt->short_aliases) {
+                len += 4 * strlen(opt->short_aliases);
+            }
+#endif
+#if OPTPARSE_LONG_OPTIONS
+            if (opt->long_name) {
+                len += 2;
+            }
+        } else if (OPTPARSE_HELP_UNIQUE_COLUMN_FOR_LONG_OPTIONS) {
+            len += 4;
+#endif
+        }
+
+#if OPTPARSE_LONG_OPTIONS
+        if (opt->long_name) {
+            len += 2 + strlen(opt->long_name);
+#if OPTPARSE_OPTION_ALIASES
+            if (opt->long_aliases) {
+                for (char **alias = opt->long_aliases; *alias; alias++) {
+                    len += 4 + strlen(*alias);
+                }
+            }
+#endif
+        }
+#endif
+
+        // Snap divider to options.
+        if (len > divider_width && len <= OPTPARSE_HELP_MAX_DIVIDER_WIDTH) {
+            divider_width = len;
+        }
+
+        if (opt->arg_name) {
+#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
+            if (opt->arg_name[0] == '[') {
+#if OPTPARSE_LONG_OPTIONS
+                if (opt->long_name) {
+                    len += 1 + strlen(opt->arg_name);
+                } else
+#endif
+                len += strlen(opt->arg_name);
+            } else
+#endif
+            len += 1 + strlen(opt->arg_name);
+        }
+
+        // Snap divider to arguments.
+        if (len > divider_width) {
+            divider_width = len;
+        }
+    }
+
+    if (divider_width > OPTPARSE_HELP_MAX_DIVIDER_WIDTH) {
+        divider_width = OPTPARSE_HELP_MAX_DIVIDER_WIDTH;
+    }
+
+    // Print options -----------------------------------------------------------
+    for (size_t i = 0; i < options->count; i++) {
+        struct optparse_opt *opt = options->items[i];
+#if OPTPARSE_HIDDEN_OPTIONS
+        if (opt->hidden) {
+            continue;
+        }
+#endif
+
+        int len = 0;
+
+        len += fprintf(stream, "%*c", OPTPARSE_HELP_INDENTATION_WIDTH, ' ');
+
+        // Print option's short name.
+        if (opt->short_name) {
+            len += fprintf(stream, "-%c", opt->short_name);
+#if OPTPARSE_OPTION_ALIASES
+            if (opt->short_aliases) {
+                for (char *c = opt->short_aliases; *c != '\0'; c++) {
+                    len += fprintf(stream, ", -%c", *c);
+                }
+            }
+#endif
+#if OPTPARSE_LONG_OPTIONS
+            if (opt->long_name) {
+                len += fprintf(stream, ", ");
+            }
+        } else if (OPTPARSE_HELP_UNIQUE_COLUMN_FOR_LONG_OPTIONS) {
+            len += fprintf(stream, "    ");
+#endif
+        }
+
+#if OPTPARSE_LONG_OPTIONS
+        // Print option's long name.
+        if (opt->long_name) {
+            len += fprintf(stream, "--%s", opt->long_name);
+#if OPTPARSE_OPTION_ALIASES
+            if (opt->long_aliases) {
+                for (char **alias = opt->long_aliases; *alias; alias++) {
+                    len += fprintf(stream, ", --%s", *alias);
+                }
+            }
+#endif
+        }
+#endif
+
+        // Print option's arguments.
+        if (opt->arg_name) {
+#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
+            if (opt->arg_name[0] == '[') {
+#if OPTPARSE_LONG_OPTIONS
+                if (opt->long_name) {
+                    len += fprintf(stream, "[=%s", opt->arg_name + 1);
+                } else
+#endif
+                len += fprintf(stream, "%s", opt->arg_name);
+            } else
+#endif
+            len += fprintf(stream, " %s", opt->arg_name);
+        }
+
+        len += fprintf(stream, "%*c", OPTPARSE_HELP_INDENTATION_WIDTH, ' ');
+
+        // Adjust spacing before printing option's description.
+        if (len < divider_width) {
+            len += fprintf(stream, "%*c", divider_width - len, ' ');
+        }
+
+        // Print option's description.
+        if (opt->description) {
+            if (len > divider_width) {
+#if OPTPARSE_HELP_FLOATING_DESCRIPTIONS
+                blockprint(stream, opt->description, len, divider_width,
+                    OPTPARSE_HELP_MAX_LINE_WIDTH);
+#else
+                fprintf(stream, "\n%*c", divider_width, ' ');
+                blockprint(stream, opt->description, divider_width,
+                    divider_width, OPTPARSE_HELP_MAX_LINE_WIDTH);
+#endif
+            } else {
+                blockprint(stream, opt->description, divider_width,
+                    divider_width, OPTPARSE_HELP_MAX_LINE_WIDTH);
+            }
+        } else {
+            fprintf(stream, "\n");
+        }
+    }
+}
+
+#if OPTPARSE_SUBCOMMANDS
+// Prints a list of a command's subcommands.
+static void print_subcommands(FILE *stream, struct ptr_array *subcommands)
+{
+    int divider_width = 0;
+
+    // Determine subcommand list's divider width.
+    for (size_t i = 0; i < subcommands->count; i++) {
+        struct optparse_cmd *subcmd = subcommands->items[i];
+        int len = strlen(subcmd->name);
+        if (subcmd->operands) {
+            len += strlen(subcmd->operands) + 1;
+        }
+        if (len > divider_width) {
+            divider_width = len;
+        }
+    }
+    divider_width += 2 * OPTPARSE_HELP_INDENTATION_WIDTH;
+    if (divider_width > OPTPARSE_HELP_MAX_DIVIDER_WIDTH) {
+        divider_width = OPTPARSE_HELP_MAX_DIVIDER_WIDTH;
+    }
+
+    // Print list of subcommands.
+    for (size_t i = 0; i < subcommands->count; i++) {
+        struct optparse_cmd *subcmd = subcommands->items[i];
+        char buffer[OPTPARSE_PRINT_BUFFER_SIZE];
+        buffer[0] = '\0';
+        int n = bprintf(buffer, "%*c%s%s%s%*c",
+            OPTPARSE_HELP_INDENTATION_WIDTH, ' ',
+            subcmd->name,
+            subcmd->operands ? " " : "",
+            subcmd->operands ? subcmd->operands : "",
+            OPTPARSE_HELP_INDENTATION_WIDTH, ' ');
+        if (n < divider_width) {
+            bprintf(buffer, "%*c", divider_width - n, ' ');
+        }
+        fprintf(stream, "%s", buffer);
+
+        if (subcmd->about) {
+            if (n > divider_width) {
+#if OPTPARSE_HELP_FLOATING_DESCRIPTIONS
+                blockprint(stream, subcmd->about, n, divider_width,
+                    OPTPARSE_HELP_MAX_LINE_WIDTH);
+#else
+                fprintf(stream, "\n%*c", divider_width, ' ');
+                blockprint(stream, subcmd->about, divider_width, divider_width,
+                    OPTPARSE_HELP_MAX_LINE_WIDTH);
+#endif
+            } else {
+                blockprint(stream, subcmd->about, divider_width, divider_width,
+                    OPTPARSE_HELP_MAX_LINE_WIDTH);
+            }
+        } else {
+            fprintf(stream, "\n");
+        }
+    }
+}
+#endif
+
+// Prints a command's complete help information: about, usage, description,
+// options, subcommands.
+// cmd_chain: a NULL-terminated array that contains a valid command chain
+static void print_help(struct optparse_ctx *ctx, FILE *stream,
+    struct optparse_cmd *cmd, int exit_status, bool noExit)
+{
+    if (stream != stderr && cmd->about) {
+        blockprint(stream, cmd->about, 0, 0, OPTPARSE_HELP_MAX_LINE_WIDTH);
+    }
+
+    // Print command's usage.
+    print_usage(stream, cmd);
+
+    // Print command's description.
+    if (cmd->description) {
+        fprintf(stream, "\n");
+        blockprint(stream, cmd->description, 0, 0,
+            OPTPARSE_HELP_MAX_LINE_WIDTH);
+    }
+
+    // Print command's options.
+    if (cmd->_index->opts.count) {
+#if OPTPARSE_HELP_LETTER_CASE == 0
+        fprintf(stream, "\nOptions:\n");
+#elif OPTPARSE_HELP_LETTER_CASE == 1
+        fprintf(stream, "\noptions:\n");
+#elif OPTPARSE_HELP_LETTER_CASE == 2
+        fprintf(stream, "\nOPTIONS:\n");
+#endif
+        print_options(stream, &cmd->_index->opts);
+    }
+
+#if OPTPARSE_SUBCOMMANDS
+    // Print list of subcommands.
+    if (cmd->_index->subcmds.count) {
+#if OPTPARSE_HELP_LETTER_CASE == 0
+        fprintf(stream, "\nCommands:\n");
+#elif OPTPARSE_HELP_LETTER_CASE == 1
+        fprintf(stream, "\ncommands:\n");
+#elif OPTPARSE_HELP_LETTER_CASE == 2
+        fprintf(stream, "\nCOMMANDS:\n");
+#endif
+        print_subcommands(stream, &cmd->_index->subcmds);
+    }
+#endif
+
+    if (!noExit)
+        quit(ctx, exit_status);
+}
+
+#if OPTPARSE_SUBCOMMANDS
+// Parses a command chain and returns the subcommmand the chain leads to.
+// Errors out if the chain is invalid.
+static struct optparse_cmd *read_cmd_chain(struct optparse_ctx *ctx,
+    struct optparse_cmd *cmd, int argc, char **argv)
+{
+    load_cmd(cmd);
+
+    if (argc > 0 && cmd->_index->subcmds.count) {
+        struct optparse_cmd *subcmd = name_table_find(
+            &cmd->_index->subcmd_names, *argv);
+        if (subcmd) {
+            return read_cmd_chain(ctx, subcmd, argc - 1, argv + 1);
+        }
+
+        optparse_error(ctx, "Unknown command: \"%s\"\n", *argv);
+        return NULL; // To satisfy the compiler.
+    } else {
+        return cmd;
+    }
+}
+#endif
+
+#if OPTPARSE_LONG_OPTIONS
+// Adds an option's long name and long aliases to a command's lookup index.
+static void index_long_names(struct optparse_index *index,
+    struct optparse_opt *opt)
+{
+    if (opt->long_name) {
+        index_name(&index->long_opts, opt->long_name, opt);
+    }
+#if OPTPARSE_OPTION_ALIASES
+    if (opt->long_aliases) {
+        for (char **alias = opt->long_aliases; *alias; alias++) {
+            index_name(&index->long_opts, *alias, opt);
+        }
+    }
+#endif
+}
+#endif
+
+#if OPTPARSE_SUBOPTIONS
+// Builds an option's sub-option lookup index, unless it already exists (e.g.
+// because the option is shared by multiple commands).
+static void index_suboptions(struct optparse_opt *opt)
+{
+    if (!opt->suboptions || opt->_subopt_index) {
+        return;
+    }
+
+    opt->_subopt_index = calloc(1, sizeof (struct optparse_subopt_index));
+    if (opt->_subopt_index == NULL) {
+        optparse_error(NULL, "Out of memory.\n");
+    }
+    for (struct optparse_subopt *subopt = opt->suboptions;
+            subopt->name != END_OF_SUBOPTIONS; subopt++) {
+        index_name(&opt->_subopt_index->keys, subopt->name, subopt);
+    }
+}
+#endif
+
+// Adds an option to a command's lookup index, including its aliases.
+static void index_option(struct optparse_index *index, struct optparse_opt *opt)
+{
+    ptr_array_append(&index->opts, opt);
+
+    // Like long names, short names must be unique within a command.
+    assert(!opt->short_name
+        || !index->short_opts[(unsigned char) opt->short_name]);
+    if (opt->short_name && !index->short_opts[(unsigned char) opt->short_name]) {
+        index->short_opts[(unsigned char) opt->short_name] = opt;
+    }
+#if OPTPARSE_OPTION_ALIASES
+    if (opt->short_aliases) {
+        for (char *c = opt->short_aliases; *c != '\0'; c++) {
+            assert(!index->short_opts[(unsigned char) *c]);
+            if (!index->short_opts[(unsigned char) *c]) {
+                index->short_opts[(unsigned char) *c] = opt;
+            }
+        }
+    }
+#endif
+
+#if OPTPARSE_LONG_OPTIONS
+    index_long_names(index, opt);
+#endif
+#if OPTPARSE_SUBOPTIONS
+    index_suboptions(opt);
+#endif
+}
+
+static void compile_cmd(struct optparse_cmd *cmd);
+#ifndef NDEBUG
+static void check_cmd(struct optparse_cmd *cmd);
+#endif
+
+#if OPTPARSE_SUBCOMMANDS
+// Adds a subcommand to a command's lookup index and compiles it.
+static void index_subcommand(struct optparse_cmd *cmd,
+    struct optparse_cmd *subcmd)
+{
+    subcmd->_parent = cmd;
+    compile_cmd(subcmd);
+    ptr_array_append(&cmd->_index->subcmds, subcmd);
+    index_name(&cmd->_index->subcmd_names, subcmd->name, subcmd);
+}
+#endif
+
+// Adds a command's options and subcommands to its lookup index.
+static void index_cmd(struct optparse_cmd *cmd)
+{
+    if (cmd->options) {
+        struct optparse_opt *opt = cmd->options;
+        while (opt->short_name != (char) END_OF_OPTIONS) {
+            index_option(cmd->_index, opt);
+            opt++;
+        }
+    }
+
+#if OPTPARSE_SUBCOMMANDS
+    if (cmd->subcommands) {
+        struct optparse_cmd *subcmd = cmd->subcommands;
+        while (subcmd->name != END_OF_SUBCOMMANDS) {
+            index_subcommand(cmd, subcmd);
+            subcmd++;
+        }
+    }
+#endif
+}
+
+// Recursively checks and builds the lookup indexes of a command and its
+// subcommands. Commands that already have an index are skipped.
+static void compile_cmd(struct optparse_cmd *cmd)
+{
+    if (cmd->_index) {
+        return;
+    }
+
+#ifndef NDEBUG
+    check_cmd(cmd);
+#endif
+
+    cmd->_index = calloc(1, sizeof (struct optparse_index));
+    if (cmd->_index == NULL) {
+        optparse_error(NULL, "Out of memory.\n");
+    }
+
+#if OPTPARSE_SUBCOMMANDS
+    // Commands that have a provider are indexed when they are selected.
+    if (cmd->provider) {
+        return;
+    }
+#endif
+
+    index_cmd(cmd);
+}
+
+#ifndef NDEBUG
+// Checks an option for impossible/faulty setups.
+static void check_opt(struct optparse_opt *opt)
+{
+    // At least one of those is required.
+#if OPTPARSE_LONG_OPTIONS
+    assert(opt->short_name || opt->long_name);
+#else
+    assert(opt->short_name);
+#endif
+
+    // Make sure option-argument is named properly.
+    assert((opt->arg_name && opt->arg_name[0] == '['
+        && opt->arg_name[strlen(opt->arg_name) - 1] == ']')
+        || (opt->arg_name && opt->arg_name[0] != '[')
+        || !opt->arg_name);
+
+#if OPTPARSE_LIST_SUPPORT
+    // .arg_storage_size requires .arg_delim and .arg_storage.
+    assert((opt->arg_storage_size && opt->arg_delim && opt->arg_storage)
+        || !opt->arg_storage_size);
+
+    // Splitting and then calling like a non-array type-converted value
+    // existed would produce random values.
+    assert((opt->arg_delim && opt->function_type != FUNCTION_TYPE_TARG
+        && opt->function_type != FUNCTION_TYPE_CTX_TARG)
+        || !opt->arg_delim);
+
+    // If the option-argument is not split, no array exists and array
+    // functions must not be called.
+    assert((!opt->arg_delim && opt->function_type
+        != FUNCTION_TYPE_TARG_ARRAY && opt->function_type
+        != FUNCTION_TYPE_OARG_ARRAY && opt->function_type
+        != FUNCTION_TYPE_CTX_TARG_ARRAY) || opt->arg_delim);
+
+    // Only lists of integers can be sorted.
+    assert(!opt->arg_sorted
+        || (opt->arg_delim && is_integer_type(opt->arg_data_type)));
+#endif
+
+#if OPTPARSE_SUBOPTIONS
+    if (opt->suboptions) {
+        // Sub-options replace the option-argument's storage and splitting.
+        assert(opt->arg_name && !opt->arg_storage);
+#if OPTPARSE_LIST_SUPPORT
+        assert(!opt->arg_delim);
+#endif
+        for (struct optparse_subopt *subopt = opt->suboptions;
+                subopt->name != END_OF_SUBOPTIONS; subopt++) {
+            // A key that neither stores a value nor sets a flag is useless.
+            assert(subopt->storage || subopt->flag);
+            assert(subopt->name[0] != '\0' && !strpbrk(subopt->name, ",="));
+        }
+    }
+#endif
+
+#if OPTPARSE_OPTION_ALIASES
+    // Aliases are listed next to the option's name in the help screen.
+    assert(opt->short_name || !opt->short_aliases);
+#if OPTPARSE_LONG_OPTIONS
+    assert(opt->long_name || !opt->long_aliases);
+#endif
+#endif
+
+#if OPTPARSE_BIT_FLAGS
+    // Bit flags can't be incremented or decremented.
+    assert(!opt->flag_words || (opt->flag_type != FLAG_TYPE_INCREMENT
+        && opt->flag_type != FLAG_TYPE_DECREMENT));
+#endif
+
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+    // Group values must not be larger than
+    // OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX.
+    assert((opt->group && opt->group < OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX)
+        || !opt->group);
+#endif
+}
+
+// Checks a command's option structure for impossible/faulty setups. Its
+// subcommands are checked when they are compiled.
+static void check_cmd(struct optparse_cmd *cmd)
+{
+    // The command's name is required.
+    assert(cmd->name != NULL);
+
+    // Only one of both functions can be called.
+    assert(!cmd->function || !cmd->ctx_function);
+
+    if (cmd->options) {
+        struct optparse_opt *opt = cmd->options;
+        while (opt->short_name != (char) END_OF_OPTIONS) {
+            check_opt(opt);
+            opt++;
+        }
+    }
+}
+#endif
+
+#if OPTPARSE_SUBCOMMANDS
+// Sets a command's loading state and wakes up the threads waiting for it.
+// Must be called with provider_mutex locked.
+static void set_provider_state(struct optparse_cmd *cmd, int state)
+{
+#if defined(__GNUC__)
+    __atomic_store_n(&cmd->_index->provider_state, state, __ATOMIC_RELEASE);
+#else
+    cmd->_index->provider_state = state;
+#endif
+    pthread_cond_broadcast(&provider_cond);
+}
+
+// Calls a selected command's provider, once, and indexes the options and
+// subcommands it provides. If parses in several threads select the command at
+// once, one of them loads it while the others wait. If loading is aborted,
+// e.g. by an error that ends a REPL line, the command is unloaded again.
+static void load_cmd(struct optparse_cmd *cmd)
+{
+    if (!cmd->provider) {
+        return;
+    }
+#if defined(__GNUC__)
+    // Skip locking once the command is loaded.
+    if (__atomic_load_n(&cmd->_index->provider_state, __ATOMIC_ACQUIRE)
+            == PROVIDER_LOADED) {
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&provider_mutex);
+    while (cmd->_index->provider_state == PROVIDER_LOADING) {
+        pthread_cond_wait(&provider_cond, &provider_mutex);
+    }
+    if (cmd->_index->provider_state == PROVIDER_LOADED) {
+        pthread_mutex_unlock(&provider_mutex);
+        return;
+    }
+    set_provider_state(cmd, PROVIDER_LOADING);
+    pthread_mutex_unlock(&provider_mutex);
+
+#if OPTPARSE_REPL
+    // Intercept the end of a REPL line to reset the state before passing it on.
+    struct optparse_ctx *ctx = calling_ctx();
+    void *exit_jmp = ctx->_exit_jmp;
+    jmp_buf abort_jmp;
+    if (exit_jmp) {
+        if (setjmp(abort_jmp)) {
+            ctx->_exit_jmp = exit_jmp;
+            pthread_mutex_lock(&provider_mutex);
+            set_provider_state(cmd, PROVIDER_UNLOADED);
+            pthread_mutex_unlock(&provider_mutex);
+            longjmp(*(jmp_buf *) exit_jmp, 1);
+        }
+        ctx->_exit_jmp = &abort_jmp;
+    }
+#endif
+
+    cmd->provider(cmd);
+#ifndef NDEBUG
+    check_cmd(cmd);
+#endif
+    index_cmd(cmd);
+
+#if OPTPARSE_REPL
+    ctx->_exit_jmp = exit_jmp;
+#endif
+    pthread_mutex_lock(&provider_mutex);
+    set_provider_state(cmd, PROVIDER_LOADED);
+    pthread_mutex_unlock(&provider_mutex);
+}
+#endif
+
+#if OPTPARSE_PROFILE
+// Recursively writes the hit counts of a command's options to a stream.
+static void save_profile(FILE *stream, struct optparse_cmd *cmd)
+{
+    if (!cmd->_index) {
+        return;
+    }
+
+    char chain[OPTPARSE_PRINT_BUFFER_SIZE];
+    chain[0] = '\0';
+#if OPTPARSE_SUBCOMMANDS
+    bprint_cmd_chain(chain, cmd);
+#else
+    bprintf(chain, " %s", cmd->name);
+#endif
+
+    for (size_t i = 0; i < cmd->_index->opts.count; i++) {
+        struct optparse_opt *opt = cmd->_index->opts.items[i];
+        if (opt->_hits == 0) {
+            continue;
+        }
+#if OPTPARSE_LONG_OPTIONS
+        if (opt->long_name) {
+            fprintf(stream, "%lu%s --%s\n", opt->_hits, chain, opt->long_name);
+        } else
+#endif
+            fprintf(stream, "%lu%s -%c\n", opt->_hits, chain, opt->short_name);
+    }
+
+#if OPTPARSE_SUBCOMMANDS
+    for (size_t i = 0; i < cmd->_index->subcmds.count; i++) {
+        save_profile(stream, cmd->_index->subcmds.items[i]);
+    }
+#endif
+}
+
+// Returns the next whitespace-separated token of a string and advances *str
+// past it; NULL if there are no more tokens. The token is terminated in place.
+static char *next_token(char **str)
+{
+    char *token = *str + strspn(*str, " \t\r\n");
+    if (*token == '\0') {
+        return NULL;
+    }
+
+    char *end = token + strcspn(token, " \t\r\n");
+    *str = *end ? end + 1 : end;
+    *end = '\0';
+    return token;
+}
+
+// Looks up the option a profile line refers to; NULL if it doesn't exist (e.g.
+// because the command tree has changed since the profile was saved).
+// line: "<hits> <command chain> <option name>"
+static struct optparse_opt *find_profiled_option(struct optparse_cmd *cmd,
+    char *line)
+{
+    next_token(&line); // Skip the hit count.
+    next_token(&line); // Skip the root command's name.
+
+    char *token;
+    while ((token = next_token(&line)) != NULL) {
+        if (token[0] == '-') {
+#if OPTPARSE_LONG_OPTIONS
+            if (token[1] == '-') {
+                return name_table_find(&cmd->_index->long_opts, token + 2);
+            }
+#endif
+            return cmd->_index->short_opts[(unsigned char) token[1]];
+        }
+
+#if OPTPARSE_SUBCOMMANDS
+        cmd = name_table_find(&cmd->_index->subcmd_names, token);
+        if (cmd == NULL || cmd->_index == NULL) {
+            return NULL;
+        }
+#else
+        return NULL;
+#endif
+    }
+
+    return NULL;
+}
+
+#if OPTPARSE_LONG_OPTIONS
+// Inserts the long names and long aliases of an option into a new long option
+// table, but only the ones the option owns in the old table. This way a name
+// that is used twice (which is only possible with NDEBUG) keeps referring to
+// the same option.
+static void move_long_names(struct name_table *names, struct name_table *old,
+    struct optparse_opt *opt)
+{
+    if (opt->long_name && name_table_find(old, opt->long_name) == opt) {
+        name_table_insert(names, opt->long_name, opt);
+    }
+#if OPTPARSE_OPTION_ALIASES
+    if (opt->long_aliases) {
+        for (char **alias = opt->long_aliases; *alias; alias++) {
+            if (name_table_find(old, *alias) == opt) {
+                name_table_insert(names, *alias, opt);
+            }
+        }
+    }
+#endif
+}
+
+// Recursively rebuilds the long option tables of a command tree, inserting
+// options in order of descending hit count, so that the most used options sit
+// in their home slots and are found without probing.
+static void reorder_long_options(struct optparse_cmd *cmd)
+{
+    struct optparse_index *index = cmd->_index;
+    if (index == NULL) {
+        return;
+    }
+
+    size_t n = index->opts.count;
+    if (n) {
+        struct optparse_opt **opts = malloc(n * sizeof (struct optparse_opt *));
+        if (opts == NULL) {
+            optparse_error(NULL, "Out of memory.\n");
+        }
+        memcpy(opts, index->opts.items, n * sizeof (struct optparse_opt *));
+
+        // Stable insertion sort; equally used options keep their order.
+        for (size_t i = 1; i < n; i++) {
+            struct optparse_opt *opt = opts[i];
+            size_t j = i;
+            while (j > 0 && opts[j - 1]->_hits < opt->_hits) {
+                opts[j] = opts[j - 1];
+                j--;
+            }
+            opts[j] = opt;
+        }
+
+        struct name_table old = index->long_opts;
+        index->long_opts = (struct name_table) { 0 };
+        name_table_reset(&index->long_opts, old.count);
+        for (size_t i = 0; i < n; i++) {
+            move_long_names(&index->long_opts, &old, opts[i]);
+        }
+        free(old.slots);
+        free(opts);
+    }
+
+#if OPTPARSE_SUBCOMMANDS
+    for (size_t i = 0; i < index->subcmds.count; i++) {
+        reorder_long_options(index->subcmds.items[i]);
+    }
+#endif
+}
+#endif
+#endif
+
+#if OPTPARSE_REPL
+// Splits a line into arguments in place. Arguments are separated by
+// whitespace; single and double quotes group characters, a backslash escapes
+// the next character.
+// args: an array that can hold at least (strlen(line) + 1) / 2 + 1 pointers
+// Return value: the number of arguments
+static int split_line(char *line, char **args)
+{
+    int count = 0;
+    char *r = line; // Read position
+    char *w = line; // Write position
+
+    for (;;) {
+        r += strspn(r, " \t\r\n");
+        if (*r == '\0') {
+            break;
+        }
+
+        args[count++] = w;
+        char quote = '\0';
+        while (*r != '\0') {
+            if (quote) {
+                if (*r == quote) {
+                    quote = '\0';
+                    r++;
+                    continue;
+                }
+            } else if (*r == '\'' || *r == '"') {
+                quote = *r++;
+                continue;
+            } else if (strchr(" \t\r\n", *r)) {
+                r++;
+                break;
+            }
+
+            if (*r == '\\' && r[1] != '\0' && quote != '\'') {
+                r++;
+            }
+            *w++ = *r++;
+        }
+        *w++ = '\0';
+    }
+
+    args[count] = NULL;
+    return count;
+}
+
+// Reads a line of any length from a stream into a growing buffer.
+// Return value: false if there are no more lines
+static bool read_line(FILE *stream, char **line, size_t *size)
+{
+    size_t len = 0;
+    int c;
+    while ((c = getc(stream)) != EOF) {
+        if (len + 1 >= *size) {
+            size_t new_size = *size ? *size * 2 : 256;
+            char *new_line = realloc(*line, new_size);
+            if (new_line == NULL) {
+                optparse_error(NULL, "Out of memory.\n");
+            }
+            *line = new_line;
+            *size = new_size;
+        }
+        if (c == '\n') {
+            break;
+        }
+        (*line)[len++] = c;
+    }
+
+    if (c == EOF && len == 0) {
+        return false;
+    }
+    (*line)[len] = '\0';
+    return true;
+}
+
+// Parses a line's arguments. Errors and help screens end parsing early instead
+// of exiting.
+static void parse_line(struct optparse_ctx *ctx, struct optparse_cmd *cmd,
+    int argc, char **argv)
+{
+    jmp_buf exit_jmp;
+    ctx->_exit_jmp = &exit_jmp;
+    struct optparse_ctx *outer_ctx = current_ctx;
+
+    if (setjmp(exit_jmp) == 0) {
+        optparse_parse_r(ctx, cmd, &argc, &argv);
+    } else {
+        current_ctx = outer_ctx;
+#if OPTPARSE_DEFERRED_CALLBACKS
+        discard_deferred_calls(ctx);
+#endif
+    }
+
+    ctx->_exit_jmp = NULL;
+}
+#endif
+
+#if OPTPARSE_SERVER
+// The fixed-size part of a request a client sends to a server. It is followed
+// by .size bytes holding the client's working directory and its argv strings,
+// each of them NUL-terminated. The client's stdin, stdout and stderr are sent
+// along with it.
+struct request {
+    size_t argc;
+    size_t size;
+};
+
+// Writes a buffer's contents to a file descriptor, retrying on interruption.
+// Return value: false on error
+static bool write_all(int fd, const void *buffer, size_t size)
+{
+    const char *p = buffer;
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Fills a buffer from a file descriptor, retrying on interruption.
+// Return value: false on error or end of file
+static bool read_all(int fd, void *buffer, size_t size)
+{
+    char *p = buffer;
+    while (size) {
+        ssize_t n = read(fd, p, size);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
         }
+        p += n;
+        size -= n;
     }
+    return true;
 }
-#endif
 
-#if OPTPARSE_LONG_OPTIONS
-// Identifies and executes a single known long option.
-static void execute_long_option(char *long_name, struct optparse_opt options[])
+// Fills a sockaddr_un structure with a socket path.
+// Return value: false if the path is too long
+static bool make_address(struct sockaddr_un *addr, const char *socket_path)
 {
-    if (options == NULL) {
-        goto unknown_option;
+    *addr = (struct sockaddr_un) { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof addr->sun_path) {
+        errno = ENAMETOOLONG;
+        return false;
     }
+    strcpy(addr->sun_path, socket_path);
+    return true;
+}
 
-#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
-    char *arg = strchr(long_name, '=');
-    if (arg) {
-        *arg++ = '\0';
-    }
+// Returns whether a connection's peer runs as the same user as the server.
+static bool is_same_user(int conn)
+{
+#if defined(__linux__)
+    struct ucred cred;
+    socklen_t size = sizeof cred;
+    return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &size) == 0
+        && cred.uid == geteuid();
 #else
-    char *arg = NULL;
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(conn, &uid, &gid) == 0 && uid == geteuid();
 #endif
+}
 
-    struct optparse_opt *opt = options;
-    while (opt->short_name != (char) END_OF_OPTIONS) {
-        if (opt->long_name && strcmp(long_name, opt->long_name) == 0) {
-#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
-            check_mutual_exclusivity(opt);
+// Returns the maximum size of a request's payload: a working directory and a
+// command line, which can't be longer than the system allows for exec().
+static size_t get_payload_max(void)
+{
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= 0) {
+        arg_max = _POSIX_ARG_MAX;
+    }
+#ifdef PATH_MAX
+    return (size_t) arg_max + PATH_MAX;
+#else
+    return (size_t) arg_max + _POSIX_PATH_MAX;
 #endif
-            if (arg) {
-                if (!opt->arg_name) {
-                    optparse_error("Unwanted option-argument: \"%s\"\n", arg);
-                }
-            } else if (opt->arg_name && opt->arg_name[0] != '[') {
-                arg = args[++args_index];
-                if (arg == NULL) {
-                    optparse_error("Option \"--%s\" requires an argument.\n",
-                        long_name);
-                }
-            }
+}
 
-            execute_option(opt, arg);
-            return;
-        }
+// Receives a request's fixed-size part and the 3 file descriptors sent with it.
+// Return value: false on error
+static bool receive_request(int conn, struct request *req, int fds[3])
+{
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(3 * sizeof (int))];
+    } control;
+    struct iovec iov = { .iov_base = req, .iov_len = sizeof *req };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof control.buffer,
+    };
+
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, 0);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
 
-        opt++;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET
+            || cmsg->cmsg_type != SCM_RIGHTS
+            || cmsg->cmsg_len != CMSG_LEN(3 * sizeof (int))) {
+        return false;
     }
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof (int));
 
-    unknown_option:
-    optparse_error("Unknown option: \"--%s\"\n", long_name);
+    // The rest of the fixed-size part may arrive separately.
+    return read_all(conn, (char *) req + n, sizeof *req - n);
 }
-#endif
 
-// Identifies and executes a group of known short options.
-// option_group must not be NULL.
-static void execute_short_option(char *option_group,
-    struct optparse_opt options[])
+// Runs a client's command line in a child process and sends its exit status
+// back to the client. Called in a process of its own; never returns.
+static void handle_connection(struct optparse_cmd *cmd, int conn)
 {
-    char *c = option_group + 1;
-
-    if (options == NULL) {
-        goto unknown_option;
+    // Other users must not be able to run commands as the server's user.
+    if (!is_same_user(conn)) {
+        _exit(EXIT_FAILURE);
     }
 
-    while (*c != '\0') {
-        char *arg = c + 1;
-        if (*arg == '\0') {
-            arg = NULL;
-        }
+    struct request req;
+    int fds[3];
+    if (!receive_request(conn, &req, fds)) {
+        _exit(EXIT_FAILURE);
+    }
 
-        struct optparse_opt *opt = options;
-        while (opt->short_name != (char) END_OF_OPTIONS) {
-            if (*c == opt->short_name) {
-#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
-                check_mutual_exclusivity(opt);
-#endif
-                if (arg) {
-#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
-                    if (!opt->arg_name) {
-                        arg = NULL;
-                    }
-#else
-                    if (opt->arg_name) {
-                        optparse_error("Option -%c (in sequence \"%s\")"
-                            " requires an argument.\n", *c, option_group);
-                    } else {
-                        arg = NULL;
-                    }
-#endif
-                } else if (opt->arg_name && opt->arg_name[0] != '[') {
-                    arg = args[++args_index];
-                    if (arg == NULL) {
-                        optparse_error(
-                            "Option -%c requires an argument.\n", *c);
-                    }
-                }
+    // Each argument takes at least 1 byte of the payload, after the working
+    // directory.
+    if (req.size > get_payload_max() || req.argc == 0
+            || req.argc >= req.size || req.argc > INT_MAX) {
+        _exit(EXIT_FAILURE);
+    }
 
-                execute_option(opt, arg);
-                if (arg) {
-                    return;
-                } else {
-                    goto next;
-                }
-            }
+    char *payload = malloc(req.size);
+    char **argv = malloc((req.argc + 1) * sizeof (char *));
+    if (payload == NULL || argv == NULL || !read_all(conn, payload, req.size)
+            || req.size == 0 || payload[req.size - 1] != '\0') {
+        _exit(EXIT_FAILURE);
+    }
 
-            opt++;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(conn);
+        for (int i = 0; i < 3; i++) {
+            dup2(fds[i], i);
+            close(fds[i]);
         }
 
-        unknown_option:
-        if (option_group[1] != '\0' && option_group[2] != '\0') {
-            optparse_error("Unknown option: \"-%c\" (in sequence \"%s\")\n", *c,
-                option_group);
-        } else {
-            optparse_error("Unknown option: \"%s\"\n", option_group);
+        // The payload starts with the working directory, followed by argv.
+        char *s = payload;
+        if (chdir(s) == -1) {
+            fprintf(stderr, "Cannot change directory: \"%s\"\n", s);
+            _exit(EXIT_FAILURE);
+        }
+        int argc = 0;
+        char *end = payload + req.size;
+        while ((s += strlen(s) + 1) < end && (size_t) argc < req.argc) {
+            argv[argc++] = s;
         }
+        argv[argc] = NULL;
 
-        next:
-        c++;
+        optparse_parse(cmd, &argc, &argv);
+        exit(EXIT_SUCCESS);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        close(fds[i]);
+    }
+
+    int exit_status = EXIT_FAILURE;
+    if (pid != -1) {
+        int status;
+        pid_t waited;
+        do {
+            waited = waitpid(pid, &status, 0);
+        } while (waited == -1 && errno == EINTR);
+        if (waited == pid && WIFEXITED(status)) {
+            exit_status = WEXITSTATUS(status);
+        } else if (waited == pid && WIFSIGNALED(status)) {
+            exit_status = 128 + WTERMSIG(status);
+        }
     }
+    write_all(conn, &exit_status, sizeof exit_status);
+    _exit(EXIT_SUCCESS);
 }
 
-// Parses a command's command line options.
-// After parsing, only operands remain in argv.
-static void parse(int *argc, char ***argv, struct optparse_cmd *cmd)
+// Removes a socket file that a previous server has left behind. Other files,
+// and sockets a server is still listening on, are kept, so that bind() fails.
+static void remove_stale_socket(const struct sockaddr_un *addr)
 {
-    args = *argv;
-    args_index = 1;
-    *argc = 1; // To keep argv[0].
-#if OPTPARSE_SUBCOMMANDS
-    active_cmd = cmd;
-#endif
+    struct stat st;
+    if (lstat(addr->sun_path, &st) == -1 || !S_ISSOCK(st.st_mode)) {
+        return;
+    }
 
-    int ignore_options = 0;
-    while (args[args_index] != NULL) {
-        if (!ignore_options && args[args_index][0] == '-') { // Option
-            if (args[args_index][1] == '-') {
-                if (args[args_index][2] == '\0') { // Stand-alone option "--"
-                    ignore_options = 1;
-#if OPTPARSE_LONG_OPTIONS
-                } else { // Long option
-                    execute_long_option(args[args_index] + 2, cmd->options);
-#endif
-                }
-            } else { // Short option
-                execute_short_option(args[args_index], cmd->options);
-            }
-        } else { // Operand or subcommand
-#if OPTPARSE_SUBCOMMANDS
-            if (cmd->subcommands) {
-                struct optparse_cmd *subcmd = cmd->subcommands;
-                while (subcmd->name != END_OF_SUBCOMMANDS) {
-                    if (strcmp(args[args_index], subcmd->name) == 0) {
-                        // Remove previous arguments, including the subcommand,
-                        // from argv (args will be set in the next iteration).
-                        do {
-                            (*argv)[(*argc)++] = args[++args_index];
-                        } while (args[args_index]);
-                        (*argv)[*argc] = NULL;
-
-                        // Continue parsing with the subcommand.
-                        parse(argc, argv, subcmd);
-
-                        return;
-                    }
-                    subcmd++;
-                }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe == -1) {
+        return;
+    }
+    if (connect(probe, (const struct sockaddr *) addr, sizeof *addr) == -1
+            && errno == ECONNREFUSED) {
+        unlink(addr->sun_path);
+    }
+    close(probe);
+}
 
-                optparse_error("Unknown command: \"%s\"\n", args[args_index]);
-            } else
-#endif
-                // Treat argument as an operand, adding it to the new argv.
-                (*argv)[(*argc)++] = args[args_index];
+// Returns the current working directory in dynamically allocated memory; NULL
+// on error.
+static char *get_cwd(void)
+{
+    size_t size = 256;
+    for (;;) {
+        char *cwd = malloc(size);
+        if (cwd == NULL) {
+            return NULL;
         }
-
-        if (args[args_index] != NULL) { // Can be NULL due to optparse_shift().
-            args_index++;
+        if (getcwd(cwd, size)) {
+            return cwd;
+        }
+        free(cwd);
+        if (errno != ERANGE) {
+            return NULL;
         }
+        size *= 2;
+    }
+}
+
+// Sends a command line, the current working directory and stdin, stdout and
+// stderr to a server.
+// Return value: false on error
+static bool send_request(int conn, int argc, char **argv)
+{
+    char *cwd = get_cwd();
+    if (cwd == NULL) {
+        return false;
     }
 
-    (*argv)[*argc] = NULL;
+    struct request req = { .argc = argc, .size = strlen(cwd) + 1 };
+    for (int i = 0; i < argc; i++) {
+        req.size += strlen(argv[i]) + 1;
+    }
 
-    // Run command's function on remaining operands.
-    if (cmd->function) {
-        args_index = 0;
-        cmd->function(*argc, *argv);
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(3 * sizeof (int))];
+    } control;
+    memset(&control, 0, sizeof control);
+    struct iovec iov = { .iov_base = &req, .iov_len = sizeof req };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof control.buffer,
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof (int));
+    memcpy(CMSG_DATA(cmsg), (int[]) { 0, 1, 2 }, 3 * sizeof (int));
+
+    ssize_t n;
+    do {
+        n = sendmsg(conn, &msg, 0);
+    } while (n == -1 && errno == EINTR);
+
+    bool ok = n != -1
+        && write_all(conn, (char *) &req + n, sizeof req - n)
+        && write_all(conn, cwd, strlen(cwd) + 1);
+    for (int i = 0; ok && i < argc; i++) {
+        ok = write_all(conn, argv[i], strlen(argv[i]) + 1);
     }
 
+    free(cwd);
+    return ok;
 }
+#endif
 
-/// Private "help screen" functions --------------------------------------------
-
-// Prints a string using automatic word-wrapping.
-// stream: the stream the string will be printed to
-// str: the string to be printed
-// first_line_indent: the known column at which printing starts
-// indent: the indentation width (starting from line 2)
-static void blockprint(FILE *stream, char *str, int first_line_indent,
-    int indent, int end)
+#if OPTPARSE_SCHEMA_EXPORT
+#define SCHEMA_MAGIC "OP99"
+#define SCHEMA_VERSION 2
+
+// Data type names, in the order of their schema codes (see below).
+static const char *const data_type_names[] = {
+    "str", "char", "schar", "uchar", "shrt", "ushrt", "int", "uint", "long",
+    "ulong", "llong", "ullong", "flt", "dbl", "ldbl", "bool", "int8", "uint8",
+    "int16", "uint16", "int32", "uint32", "int64", "uint64"
+};
+
+// Flag type names, in the order of enum optparse_flag_type.
+static const char *const flag_type_names[] = {
+    "set_true", "set_false", "increment", "decrement", "toggle"
+};
+
+// Returns a data type's schema code, which, unlike enum optparse_data_type,
+// doesn't depend on the enabled features.
+static int get_data_type_code(enum optparse_data_type data_type)
 {
-#if OPTPARSE_HELP_WORD_WRAP
-    if (str == NULL || str[0] == '\0') {
-        fputc('\n', stream);
-        return;
+    switch (data_type) {
+        case DATA_TYPE_STR: return 0;
+        case DATA_TYPE_CHAR: return 1;
+        case DATA_TYPE_SCHAR: return 2;
+        case DATA_TYPE_UCHAR: return 3;
+        case DATA_TYPE_SHRT: return 4;
+        case DATA_TYPE_USHRT: return 5;
+        case DATA_TYPE_INT: return 6;
+        case DATA_TYPE_UINT: return 7;
+        case DATA_TYPE_LONG: return 8;
+        case DATA_TYPE_ULONG: return 9;
+        case DATA_TYPE_LLONG: return 10;
+        case DATA_TYPE_ULLONG: return 11;
+#if OPTPARSE_FLOATING_POINT_SUPPORT
+        case DATA_TYPE_FLT: return 12;
+        case DATA_TYPE_DBL: return 13;
+        case DATA_TYPE_LDBL: return 14;
+#endif
+        case DATA_TYPE_BOOL: return 15;
+#if OPTPARSE_C99_INTEGER_TYPES_SUPPORT
+        case DATA_TYPE_INT8: return 16;
+        case DATA_TYPE_UINT8: return 17;
+        case DATA_TYPE_INT16: return 18;
+        case DATA_TYPE_UINT16: return 19;
+        case DATA_TYPE_INT32: return 20;
+        case DATA_TYPE_UINT32: return 21;
+        case DATA_TYPE_INT64: return 22;
+        case DATA_TYPE_UINT64: return 23;
+#endif
+        default: return 0;
     }
+}
 
-    int first_line_printed = 0;
-    int width = end - indent;
-
-    while (1) {
-        // Indentation
-        if (first_line_printed) {
-            fprintf(stream, "%*s", indent, "");
-        } else {
-            if (first_line_indent > end) {
-                // Indentation exceeds block width
-                // Intentionally break into new line
-                width = 0;
-            } else {
-                // Indentation does not exceed block width
-                width = end - first_line_indent;
-            }
-        }
+// Describes the members of an option that are only available with certain
+// features, so that the export functions don't need to check them.
+struct schema_opt {
+    const char *long_name;
+    const char *short_aliases;
+    char **long_aliases;
+    const char *arg_delim;
+    int group;
+    bool hidden;
+};
+
+// Fills in an option's feature-dependent schema members.
+static void get_schema_opt(struct optparse_opt *opt, struct schema_opt *s)
+{
+    *s = (struct schema_opt) { 0 };
+#if OPTPARSE_LONG_OPTIONS
+    s->long_name = opt->long_name;
+#endif
+#if OPTPARSE_OPTION_ALIASES
+    s->short_aliases = opt->short_aliases;
+#if OPTPARSE_LONG_OPTIONS
+    s->long_aliases = opt->long_aliases;
+#endif
+#endif
+#if OPTPARSE_LIST_SUPPORT
+    s->arg_delim = opt->arg_delim;
+#endif
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+    s->group = opt->group;
+#endif
+#if OPTPARSE_HIDDEN_OPTIONS
+    s->hidden = opt->hidden;
+#endif
+#if !OPTPARSE_LONG_OPTIONS && !OPTPARSE_OPTION_ALIASES \
+    && !OPTPARSE_LIST_SUPPORT && !OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS \
+    && !OPTPARSE_HIDDEN_OPTIONS
+    (void) opt;
+#endif
+}
 
-        int n = 0; // Number of characters to be printed on the current line
+// Returns whether an option sets a flag or a bit flag.
+static bool has_flag(struct optparse_opt *opt)
+{
+#if OPTPARSE_BIT_FLAGS
+    if (opt->flag_words) {
+        return true;
+    }
+#endif
+    return opt->flag != NULL;
+}
 
-        while (n <= width) {
-            // Print early when encountering a newline character.
-            if (str[n] == '\n') {
-                fprintf(stream, "%.*s", ++n, str);
-                str += n;
-                goto next;
-            }
-            // Print and finish if string is shorter than width.
-            if (str[n] == '\0') {
-                fprintf(stream, "%s\n", str);
-                return;
-            }
-            n++;
-        } // If this loop survives, word-wrapping will happen.
-        n--;
+// Writes a string as a JSON string, or null if it is NULL.
+static void json_string(FILE *stream, const char *s)
+{
+    if (s == NULL) {
+        fputs("null", stream);
+        return;
+    }
 
-        // First make sure not to truncate the last word...
-        while (n > 0 && str[n] != ' ') {
-            n--;
+    putc('"', stream);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(stream, "\\%c", c);
+        } else if (c == '\n') {
+            fputs("\\n", stream);
+        } else if (c == '\t') {
+            fputs("\\t", stream);
+        } else if (c < 0x20) {
+            fprintf(stream, "\\u%04x", c);
+        } else {
+            putc(c, stream);
         }
+    }
+    putc('"', stream);
+}
 
-        // ...then make sure not to print any trailing spaces.
-        while (n > 0 && str[n - 1] == ' ') {
-            n--;
+// Writes an option's sub-options as a JSON array.
+static void export_json_subopts(FILE *stream, struct optparse_opt *opt)
+{
+    putc('[', stream);
+#if OPTPARSE_SUBOPTIONS
+    for (struct optparse_subopt *subopt = opt->suboptions;
+            subopt && subopt->name != END_OF_SUBOPTIONS; subopt++) {
+        if (subopt != opt->suboptions) {
+            putc(',', stream);
         }
+        fputs("{\"name\":", stream);
+        json_string(stream, subopt->name);
+        fputs(",\"data_type\":", stream);
+        json_string(stream, data_type_names[get_data_type_code(
+            subopt->data_type)]);
+        fprintf(stream, ",\"value\":%s,\"flag\":%s,\"description\":",
+            subopt->storage ? "true" : "false",
+            subopt->flag ? "true" : "false");
+        json_string(stream, subopt->description);
+        putc('}', stream);
+    }
+#else
+    (void) opt;
+#endif
+    putc(']', stream);
+}
 
-        // Truncate if the string is too long.
-        if (n == 0) {
-            n = width;
+// Writes an option as a JSON object.
+static void export_json_opt(FILE *stream, struct optparse_opt *opt)
+{
+    struct schema_opt s;
+    get_schema_opt(opt, &s);
+    char short_name[2] = { opt->short_name, '\0' };
+
+    fputs("{\"short_name\":", stream);
+    json_string(stream, opt->short_name ? short_name : NULL);
+    fputs(",\"long_name\":", stream);
+    json_string(stream, s.long_name);
+    fputs(",\"short_aliases\":", stream);
+    json_string(stream, s.short_aliases);
+    fputs(",\"long_aliases\":[", stream);
+    for (char **alias = s.long_aliases; alias && *alias; alias++) {
+        if (alias != s.long_aliases) {
+            putc(',', stream);
         }
+        json_string(stream, *alias);
+    }
+    fputs("],\"arg_name\":", stream);
+    json_string(stream, opt->arg_name);
+    fprintf(stream, ",\"arg_optional\":%s",
+        opt->arg_name && opt->arg_name[0] == '[' ? "true" : "false");
+    fputs(",\"arg_data_type\":", stream);
+    json_string(stream, data_type_names[get_data_type_code(opt->arg_data_type)]);
+    fputs(",\"arg_delim\":", stream);
+    json_string(stream, s.arg_delim);
+    fputs(",\"flag_type\":", stream);
+    json_string(stream, has_flag(opt) ? flag_type_names[opt->flag_type] : NULL);
+    fprintf(stream, ",\"group\":%d,\"hidden\":%s,\"description\":", s.group,
+        s.hidden ? "true" : "false");
+    json_string(stream, opt->description);
+    fputs(",\"suboptions\":", stream);
+    export_json_subopts(stream, opt);
+    putc('}', stream);
+}
 
-        fprintf(stream, "%.*s\n", n, str);
-        str += n;
+// Recursively writes a command and its subcommands as JSON objects.
+static void export_json_cmd(FILE *stream, struct optparse_cmd *cmd)
+{
+#if OPTPARSE_SUBCOMMANDS
+    load_cmd(cmd);
+#endif
 
-        // Remove word-separating leading space before printing the next line.
-        if (str[0] == ' ') {
-            str++;
+    fputs("{\"name\":", stream);
+    json_string(stream, cmd->name);
+    fputs(",\"about\":", stream);
+    json_string(stream, cmd->about);
+    fputs(",\"description\":", stream);
+    json_string(stream, cmd->description);
+    fputs(",\"operands\":", stream);
+    json_string(stream, cmd->operands);
+    fputs(",\"usage\":", stream);
+    json_string(stream, cmd->usage);
+
+    fputs(",\"options\":[", stream);
+    struct ptr_array *opts = &cmd->_index->opts;
+    for (size_t i = 0; i < opts->count; i++) {
+        if (i) {
+            putc(',', stream);
         }
+        export_json_opt(stream, opts->items[i]);
+    }
 
-        next:
-        if (first_line_printed == 0) {
-            first_line_printed = 1;
-            width = end - indent;
+    fputs("],\"subcommands\":[", stream);
+#if OPTPARSE_SUBCOMMANDS
+    struct ptr_array *subcmds = &cmd->_index->subcmds;
+    for (size_t i = 0; i < subcmds->count; i++) {
+        if (i) {
+            putc(',', stream);
         }
+        export_json_cmd(stream, subcmds->items[i]);
     }
-#else
-    fprintf(stream, "%s\n", str);
 #endif
+    fputs("]}", stream);
 }
 
+// Writes an unsigned integer in LEB128 form (7 bits per byte, least
+// significant first; the high bit marks continuation).
+static void write_varint(FILE *stream, unsigned long long n)
+{
+    while (n >= 0x80) {
+        putc((int) (n & 0x7F) | 0x80, stream);
+        n >>= 7;
+    }
+    putc((int) n, stream);
+}
 
-#if OPTPARSE_SUBCOMMANDS
-// Makes a command's parent command known to all of the command's subcommands.
-// Returns the maximum depth of nested commands.
-static int initialize_subcommand_parents(struct optparse_cmd *cmd, int depth)
+// Writes a string as its length + 1 (0 for NULL), followed by its characters.
+static void write_string(FILE *stream, const char *s)
 {
-    if (cmd->subcommands) {
-        int max_depth = 0;
-        struct optparse_cmd *subcmd = cmd->subcommands;
-        while (subcmd->name != END_OF_SUBCOMMANDS) {
-            subcmd->_parent = cmd;
-            int ret = initialize_subcommand_parents(subcmd, depth + 1);
-            if (ret > max_depth) {
-                max_depth = ret;
-            }
-            subcmd++;
-        }
-        return max_depth;
-    } else {
-        return depth;
+    if (s == NULL) {
+        write_varint(stream, 0);
+        return;
     }
+
+    size_t len = strlen(s);
+    write_varint(stream, len + 1);
+    fwrite(s, 1, len, stream);
 }
+
+// Writes an option's sub-options in binary form.
+static void export_binary_subopts(FILE *stream, struct optparse_opt *opt)
+{
+#if OPTPARSE_SUBOPTIONS
+    size_t n = 0;
+    while (opt->suboptions && opt->suboptions[n].name != END_OF_SUBOPTIONS) {
+        n++;
+    }
+    write_varint(stream, n);
+    for (size_t i = 0; i < n; i++) {
+        struct optparse_subopt *subopt = &opt->suboptions[i];
+        write_string(stream, subopt->name);
+        putc(get_data_type_code(subopt->data_type), stream);
+        putc(subopt->storage != NULL, stream);
+        putc(subopt->flag != NULL, stream);
+        write_string(stream, subopt->description);
+    }
+#else
+    (void) opt;
+    write_varint(stream, 0);
 #endif
+}
 
-#if OPTPARSE_SUBCOMMANDS
-// Fills an array with the names of a command's parents, including the root
-// command, and the command itself, in the order in which they appear in the
-// command tree.
-static void build_cmd_array(struct optparse_cmd *cmd,
-    char *array[subcmd_depth + 1])
+// Writes an option in binary form.
+static void export_binary_opt(FILE *stream, struct optparse_opt *opt)
 {
-    char *temp_array[subcmd_depth + 1];
+    struct schema_opt s;
+    get_schema_opt(opt, &s);
+
+    putc((unsigned char) opt->short_name, stream);
+    write_string(stream, s.long_name);
+    write_string(stream, s.short_aliases);
+    size_t n = 0;
+    while (s.long_aliases && s.long_aliases[n]) {
+        n++;
+    }
+    write_varint(stream, n);
+    for (size_t i = 0; i < n; i++) {
+        write_string(stream, s.long_aliases[i]);
+    }
+    write_string(stream, opt->arg_name);
+    putc(get_data_type_code(opt->arg_data_type), stream);
+    write_string(stream, s.arg_delim);
+    putc(has_flag(opt) ? opt->flag_type + 1 : 0, stream);
+    // Zigzag encoding, so that negative groups stay short.
+    write_varint(stream, s.group < 0 ? -2ULL * s.group - 1 : 2ULL * s.group);
+    putc(s.hidden, stream);
+    write_string(stream, opt->description);
+    export_binary_subopts(stream, opt);
+}
 
-    int i = 0;
-    do {
-        temp_array[i] = cmd->name;
-        cmd = cmd->_parent;
-        i++;
-    } while (cmd);
+// Recursively writes a command and its subcommands in binary form.
+static void export_binary_cmd(FILE *stream, struct optparse_cmd *cmd)
+{
+#if OPTPARSE_SUBCOMMANDS
+    load_cmd(cmd);
+#endif
+
+    write_string(stream, cmd->name);
+    write_string(stream, cmd->about);
+    write_string(stream, cmd->description);
+    write_string(stream, cmd->operands);
+    write_string(stream, cmd->usage);
+
+    struct ptr_array *opts = &cmd->_index->opts;
+    write_varint(stream, opts->count);
+    for (size_t i = 0; i < opts->count; i++) {
+        export_binary_opt(stream, opts->items[i]);
+    }
 
-    // Reverse
-    int size = i;
-    i = 0;
-    while (i < size) {
-        array[i] = temp_array[size - 1 - i];
-        i++;
+#if OPTPARSE_SUBCOMMANDS
+    struct ptr_array *subcmds = &cmd->_index->subcmds;
+    write_varint(stream, subcmds->count);
+    for (size_t i = 0; i < subcmds->count; i++) {
+        export_binary_cmd(stream, subcmds->items[i]);
     }
-    array[i] = NULL;
+#else
+    write_varint(stream, 0);
+#endif
 }
 #endif
 
-#if OPTPARSE_HELP_USAGE_STYLE == 1 && OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
-// Prints all of a specified group's mutually exlusive options to a buffer.
-// Assumes there are at least 2 group members.
-static void bprint_exclusive_option_group(char *buffer,
-    struct optparse_opt *opt, int *printed_groups)
+#if OPTPARSE_TREE_STATS
+// Returns the size of a string, including its terminator; 0 if it is NULL.
+static size_t string_size(const char *s)
 {
-    int group_index = opt->group;
+    return s ? strlen(s) + 1 : 0;
+}
 
-    // Don't print groups that have already been printed.
-    if (printed_groups[group_index]) {
-        return;
+#if OPTPARSE_LONG_OPTIONS || OPTPARSE_SUBCOMMANDS || OPTPARSE_SUBOPTIONS
+// Adds a name table to the statistics of its kind.
+// Return value: the size of the table's slots, in bytes.
+static size_t add_table_stats(struct optparse_table_stats *stats,
+    struct name_table *table)
+{
+    stats->table_count++;
+    stats->entry_count += table->count;
+    stats->slot_count += table->capacity;
+    if (table->capacity == 0) {
+        return 0;
     }
 
-    bprintf(buffer, " [");
-    bprint_option_usage(buffer, opt);
+    double load_factor = (double) table->count / table->capacity;
+    if (load_factor > stats->max_load_factor) {
+        stats->max_load_factor = load_factor;
+    }
 
-    while ((++opt)->short_name != (char) END_OF_OPTIONS) {
-        if (opt->group == group_index) {
-            bprintf(buffer, "|");
-            bprint_option_usage(buffer, opt);
+    // A lookup examines every slot from a name's home slot up to its own.
+    size_t mask = table->capacity - 1;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].name) {
+            size_t probe_length = ((i - (size_t) table->slots[i].hash) & mask)
+                + 1;
+            if (probe_length > stats->max_probe_length) {
+                stats->max_probe_length = probe_length;
+            }
         }
     }
-
-    bprintf(buffer, "]");
-    printed_groups[group_index] = 1; // Mark group as printed.
+    return table->capacity * sizeof (struct name_slot);
 }
 #endif
 
-// Prints a command's usage.
-static void print_usage(FILE *stream, struct optparse_cmd *cmd)
+// Adds an option's strings and sub-option index to a command tree's statistics.
+static void add_option_stats(struct optparse_tree_stats *stats,
+    struct optparse_opt *opt)
 {
-#if OPTPARSE_SUBCOMMANDS
-    static int parents_initialized;
-    if (parents_initialized == 0) {
-        subcmd_depth = initialize_subcommand_parents(optparse_main_cmd, 1);
-        parents_initialized = 1;
+#if OPTPARSE_LONG_OPTIONS
+    stats->name_bytes += string_size(opt->long_name);
+#endif
+#if OPTPARSE_OPTION_ALIASES
+    stats->name_bytes += string_size(opt->short_aliases);
+#if OPTPARSE_LONG_OPTIONS
+    if (opt->long_aliases) {
+        for (char **alias = opt->long_aliases; *alias; alias++) {
+            stats->name_bytes += string_size(*alias);
+        }
+    }
+#endif
+#endif
+    stats->name_bytes += string_size(opt->arg_name);
+    stats->description_bytes += string_size(opt->description);
+
+#if OPTPARSE_SUBOPTIONS
+    if (opt->_subopt_index) {
+        for (struct optparse_subopt *subopt = opt->suboptions;
+                subopt->name != END_OF_SUBOPTIONS; subopt++) {
+            stats->name_bytes += string_size(subopt->name);
+            stats->description_bytes += string_size(subopt->description);
+        }
+        stats->index_bytes += sizeof (struct optparse_subopt_index)
+            + add_table_stats(&stats->suboptions, &opt->_subopt_index->keys);
     }
 #endif
+}
 
-#if OPTPARSE_HELP_LETTER_CASE == 0
-    fprintf(stream, "Usage:");
-#elif OPTPARSE_HELP_LETTER_CASE == 1
-    fprintf(stream, "usage:");
-#elif OPTPARSE_HELP_LETTER_CASE == 2
-    fprintf(stream, "USAGE:");
+// Recursively adds a command and its subcommands to a command tree's
+// statistics. level: the command's distance from the root command.
+static void add_cmd_stats(struct optparse_tree_stats *stats,
+    struct optparse_cmd *cmd, size_t level)
+{
+#if OPTPARSE_SUBCOMMANDS
+    load_cmd(cmd);
 #endif
+    struct optparse_index *index = cmd->_index;
+
+    size_t i = level < OPTPARSE_TREE_STATS_LEVELS_MAX ? level
+        : OPTPARSE_TREE_STATS_LEVELS_MAX - 1;
+    stats->level_commands[i]++;
+    stats->level_options[i] += index->opts.count;
+    stats->command_count++;
+    stats->option_count += index->opts.count;
+    if (level + 1 > stats->depth) {
+        stats->depth = level + 1;
+    }
 
-    char buffer[OPTPARSE_PRINT_BUFFER_SIZE];
-    buffer[0] = '\0';
+    stats->name_bytes += string_size(cmd->name);
+    stats->description_bytes += string_size(cmd->about)
+        + string_size(cmd->description) + string_size(cmd->operands)
+        + string_size(cmd->usage);
 
-    // If a custom usage string is provided, print it and return.
-    if (cmd->usage) {
-        bprintf(buffer, " %s\n", cmd->usage);
-        goto print;
+    stats->index_bytes += sizeof (struct optparse_index)
+        + index->opts.capacity * sizeof (void *);
+#if OPTPARSE_LONG_OPTIONS
+    stats->index_bytes += add_table_stats(&stats->long_options,
+        &index->long_opts);
+#endif
+    for (size_t j = 0; j < index->opts.count; j++) {
+        add_option_stats(stats, index->opts.items[j]);
     }
 
-    // Print command name(s).
 #if OPTPARSE_SUBCOMMANDS
-    {
-        char *cmd_array[subcmd_depth + 1];
-        build_cmd_array(cmd, cmd_array);
-        for (int i = 0; cmd_array[i]; i++) {
-            bprintf(buffer, " %s", cmd_array[i]);
-        }
+    stats->index_bytes += index->subcmds.capacity * sizeof (void *)
+        + add_table_stats(&stats->subcommands, &index->subcmd_names);
+    for (size_t j = 0; j < index->subcmds.count; j++) {
+        add_cmd_stats(stats, index->subcmds.items[j], level + 1);
     }
-#else
-    bprintf(buffer, " %s", optparse_main_cmd->name);
 #endif
-
-    // Print command's options.
-    if (cmd->options) {
-#if OPTPARSE_HELP_USAGE_STYLE == 1
-#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
-        int printed_groups[OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX] = { 0 };
+}
 #endif
 
-        struct optparse_opt *opt = cmd->options;
-        while (opt->short_name != (char) END_OF_OPTIONS) {
-#if OPTPARSE_HIDDEN_OPTIONS
-            // Don't print options marked as "hidden".
-            if (opt->hidden) {
-                opt++;
-                continue;
-            }
-#endif
+#if OPTPARSE_CANONICAL_ARGV
+// Returns an occurrence's option-argument.
+static char *occurrence_arg(struct optparse_ctx *ctx,
+    struct optparse_occurrence *occ)
+{
+    return occ->arg_copy ? ctx->_arg_copies + occ->arg_copy - 1 : occ->arg;
+}
 
-#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
-            if (opt->group) {
-                bprint_exclusive_option_group(buffer, opt, printed_groups);
-            } else
-#endif
-            {
-                bprintf(buffer, " [");
-                bprint_option_usage(buffer, opt);
-                bprintf(buffer, "]");
-            }
-            opt++;
-        }
-#else
-        bprintf(buffer, " [" OPTPARSE_HELP_USAGE_OPTIONS_STRING "]");
-#endif
+// Returns whether using an option multiple times has the same effect as using
+// it once (the last time).
+static bool is_idempotent(struct optparse_opt *opt)
+{
+    if (opt->function) {
+        return false;
     }
 
-    // Print command's operands.
-    if (cmd->operands) {
-        bprintf(buffer, " %s", cmd->operands);
+    bool has_flag = opt->flag != NULL;
+#if OPTPARSE_BIT_FLAGS
+    has_flag = has_flag || opt->flag_words != NULL;
+#endif
+    return !has_flag || (opt->flag_type != FLAG_TYPE_INCREMENT
+        && opt->flag_type != FLAG_TYPE_DECREMENT
+        && opt->flag_type != FLAG_TYPE_TOGGLE);
+}
+
+// Returns whether two options modify the same variables.
+static bool same_target(struct optparse_opt *a, struct optparse_opt *b)
+{
+    if (a == b) {
+        return true;
+    }
+    if (a->storage_type != b->storage_type) {
+        return false;
     }
 
-    print:
-    blockprint(stream, buffer, 7, 7, OPTPARSE_HELP_MAX_LINE_WIDTH);
+    bool same_flag = a->flag == b->flag;
+#if OPTPARSE_BIT_FLAGS
+    same_flag = same_flag && a->flag_words == b->flag_words
+        && (a->flag_words == NULL || a->flag_bit == b->flag_bit);
+    if (a->flag_words) {
+        return same_flag && a->arg_storage == b->arg_storage;
+    }
+#endif
+    return same_flag && a->arg_storage == b->arg_storage
+        && (a->flag || a->arg_storage);
 }
 
-// Prints a set of options (names, arguments, descriptions).
-// Returns the calculated divider width.
-static void print_options(FILE *stream, struct optparse_opt options[])
+// Decides whether an option occurrence is part of the canonical command line:
+// repeats whose effect is overridden later are merged into the last one, pairs
+// of toggles cancel each other out, and flags that end up with the value they
+// had before parsing are omitted.
+static bool is_canonical(struct optparse_ctx *ctx,
+    struct optparse_occurrence *occ)
 {
-    struct optparse_opt *opt = options;
-    int divider_width = 0;
-
-    // Determine divider width -------------------------------------------------
-    // (see section "Print" below to know where the numbers come from)
-    while (opt->short_name != (char) END_OF_OPTIONS) {
-#if OPTPARSE_HIDDEN_OPTIONS
-        if (opt->hidden) {
-            opt++;
+    struct optparse_occurrence *occurrences = ctx->_occurrences;
+    size_t n = ctx->_occurrence_count;
+    struct optparse_occurrence *first = occ; // First of the same target.
+    size_t toggles = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        struct optparse_occurrence *other = &occurrences[i];
+        if (other->cmd != occ->cmd || !same_target(occ->opt, other->opt)) {
             continue;
         }
-#endif
-
-        int len = OPTPARSE_HELP_INDENTATION_WIDTH * 2;
 
-        if (opt->short_name) {
-            len += 2;
-#if OPTPARSE_LONG_OPTIONS
-            if (opt->long_name) {
-                len += 2;
+        if (other->seq > occ->seq && is_idempotent(other->opt)) {
+            return false; // Overridden later.
+        }
+        if (other->seq < first->seq && is_idempotent(occ->opt)) {
+            first = other;
+        }
+        if (other->opt == occ->opt) {
+            toggles++;
+            if (other->seq > occ->seq && occ->opt->flag_type
+                    == FLAG_TYPE_TOGGLE) {
+                return false; // Merged into the last toggle.
             }
-        } else if (OPTPARSE_HELP_UNIQUE_COLUMN_FOR_LONG_OPTIONS) {
-            len += 4;
-#endif
         }
+    }
 
-#if OPTPARSE_LONG_OPTIONS
-        if (opt->long_name) {
-            len += 2 + strlen(opt->long_name);
-        }
-#endif
+    if (!is_idempotent(occ->opt)) {
+        return occ->opt->function || occ->opt->flag_type != FLAG_TYPE_TOGGLE
+            || toggles % 2;
+    }
 
-        // Snap divider to options.
-        if (len > divider_width && len <= OPTPARSE_HELP_MAX_DIVIDER_WIDTH) {
-            divider_width = len;
-        }
+    // A flag-only option is omitted if the flag has its original value.
+    return occ->opt->arg_name || occ->opt->arg_storage
+        || get_flag(ctx, occ->opt) != first->flag_before;
+}
 
-        if (opt->arg_name) {
-#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
-            if (opt->arg_name[0] == '[') {
+// Compares option occurrences by option name and, for equal names, by position.
+static int compare_occurrences(const void *a, const void *b)
+{
+    const struct optparse_occurrence *x = a;
+    const struct optparse_occurrence *y = b;
+    char x_name[2] = { x->opt->short_name, '\0' };
+    char y_name[2] = { y->opt->short_name, '\0' };
+    const char *x_key = x_name;
+    const char *y_key = y_name;
 #if OPTPARSE_LONG_OPTIONS
-                if (opt->long_name) {
-                    len += 1 + strlen(opt->arg_name);
-                } else
-#endif
-                len += strlen(opt->arg_name);
-            } else
+    if (x->opt->long_name) {
+        x_key = x->opt->long_name;
+    }
+    if (y->opt->long_name) {
+        y_key = y->opt->long_name;
+    }
 #endif
-            len += 1 + strlen(opt->arg_name);
-        }
 
-        // Snap divider to arguments.
-        if (len > divider_width) {
-            divider_width = len;
-        }
-        opt++;
+    int ret = strcmp(x_key, y_key);
+    if (ret == 0) {
+        ret = (x->seq > y->seq) - (x->seq < y->seq);
     }
+    return ret;
+}
 
-    if (divider_width > OPTPARSE_HELP_MAX_DIVIDER_WIDTH) {
-        divider_width = OPTPARSE_HELP_MAX_DIVIDER_WIDTH;
+// Collects the strings of a canonical command line. In the first pass, only
+// their number and size are counted; in the second pass, they are written.
+struct canonical_writer {
+    char **argv;   // NULL while counting
+    char *strings;
+    size_t argc;
+    size_t size;   // The size of all strings
+};
+
+// Adds the concatenation of up to 4 strings to a canonical command line.
+static void emit(struct canonical_writer *w, const char *a, const char *b,
+    const char *c, const char *d)
+{
+    const char *parts[] = { a, b, c, d };
+    if (w->argv) {
+        w->argv[w->argc] = w->strings + w->size;
     }
-
-    // Print options -----------------------------------------------------------
-    opt = options;
-    while (opt->short_name != (char) END_OF_OPTIONS) {
-#if OPTPARSE_HIDDEN_OPTIONS
-        if (opt->hidden) {
-            opt++;
+    for (int i = 0; i < 4; i++) {
+        if (parts[i] == NULL) {
             continue;
         }
-#endif
+        size_t len = strlen(parts[i]);
+        if (w->argv) {
+            memcpy(w->strings + w->size, parts[i], len);
+        }
+        w->size += len;
+    }
+    if (w->argv) {
+        w->strings[w->size] = '\0';
+    }
+    w->size++;
+    w->argc++;
+}
 
-        int len = 0;
+// Adds a command's name (unless it is the main command) and its options to a
+// canonical command line, preceded by its parent commands.
+static void emit_cmd(struct canonical_writer *w, struct optparse_ctx *ctx,
+    struct optparse_cmd *cmd)
+{
+#if OPTPARSE_SUBCOMMANDS
+    if (cmd->_parent && cmd != ctx->_main_cmd) {
+        emit_cmd(w, ctx, cmd->_parent);
+        emit(w, cmd->name, NULL, NULL, NULL);
+    }
+#endif
 
-        len += fprintf(stream, "%*c", OPTPARSE_HELP_INDENTATION_WIDTH, ' ');
+    for (size_t i = 0; i < ctx->_occurrence_count; i++) {
+        struct optparse_occurrence *occ = &ctx->_occurrences[i];
+        if (occ->cmd != cmd || !is_canonical(ctx, occ)) {
+            continue;
+        }
 
-        // Print option's short name.
-        if (opt->short_name) {
-            len += fprintf(stream, "-%c", opt->short_name);
+        char *arg = occurrence_arg(ctx, occ);
+        char short_name[3] = { '-', occ->opt->short_name, '\0' };
 #if OPTPARSE_LONG_OPTIONS
-            if (opt->long_name) {
-                len += fprintf(stream, ", ");
+        if (occ->opt->long_name) {
+#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
+            emit(w, "--", occ->opt->long_name, arg ? "=" : NULL, arg);
+#else
+            emit(w, "--", occ->opt->long_name, NULL, NULL);
+            if (arg) {
+                emit(w, arg, NULL, NULL, NULL);
+            }
+#endif
+        } else
+#endif
+        {
+#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
+            emit(w, short_name, arg, NULL, NULL);
+#else
+            emit(w, short_name, NULL, NULL, NULL);
+            if (arg) {
+                emit(w, arg, NULL, NULL, NULL);
             }
-        } else if (OPTPARSE_HELP_UNIQUE_COLUMN_FOR_LONG_OPTIONS) {
-            len += fprintf(stream, "    ");
 #endif
         }
-
-#if OPTPARSE_LONG_OPTIONS
-        // Print option's long name.
-        if (opt->long_name) {
-            len += fprintf(stream, "--%s", opt->long_name);
-        }
+    }
+}
 #endif
 
-        // Print option's arguments.
-        if (opt->arg_name) {
-#if OPTPARSE_ATTACHED_OPTION_ARGUMENTS
-            if (opt->arg_name[0] == '[') {
-#if OPTPARSE_LONG_OPTIONS
-                if (opt->long_name) {
-                    len += fprintf(stream, "[=%s", opt->arg_name + 1);
-                } else
+/// Public functions -----------------------------------------------------------
+
+// Parses command line options as described in the provided command structure.
+void optparse_parse(struct optparse_cmd *cmd, int *argc, char ***argv)
+{
+    optparse_parse_r(&global_ctx, cmd, argc, argv);
+}
+
+// Same as optparse_parse(), but keeps the parsing state in *ctx.
+void optparse_parse_r(struct optparse_ctx *ctx, struct optparse_cmd *cmd,
+    int *argc, char ***argv)
+{
+    *ctx = (struct optparse_ctx) {
+        .userdata = ctx->userdata,
+        .base = ctx->base,
+#if OPTPARSE_COLLECT_ERRORS
+        .collect_errors = ctx->collect_errors,
 #endif
-                len += fprintf(stream, "%s", opt->arg_name);
-            } else
+#if OPTPARSE_CONVERSION_CACHE
+        .cache_dir = ctx->cache_dir,
+        // Arrays stored by earlier parses stay mapped.
+        ._cache_maps = ctx->_cache_maps,
+        ._cache_map_count = ctx->_cache_map_count,
+        ._cache_map_capacity = ctx->_cache_map_capacity,
 #endif
-            len += fprintf(stream, " %s", opt->arg_name);
-        }
+#if OPTPARSE_REPL
+        ._arena = ctx->_arena,
+        ._exit_jmp = ctx->_exit_jmp,
+#endif
+#if OPTPARSE_CANONICAL_ARGV
+        // Keep the buffers for reuse.
+        ._occurrences = ctx->_occurrences,
+        ._occurrence_capacity = ctx->_occurrence_capacity,
+        ._arg_copies = ctx->_arg_copies,
+        ._arg_copies_capacity = ctx->_arg_copies_capacity,
+#endif
+    };
+    ctx->_main_cmd = cmd;
+    ctx->_args_end = *argv + *argc;
+    if (cmd) {
+        struct optparse_ctx *outer_ctx = current_ctx;
+        current_ctx = ctx;
+        optparse_compile(cmd);
+        parse(ctx, argc, argv, cmd);
+        current_ctx = outer_ctx;
+    }
+}
 
-        len += fprintf(stream, "%*c", OPTPARSE_HELP_INDENTATION_WIDTH, ' ');
+#if OPTPARSE_REPL
+// Parses each line read from a stream like a command line.
+int optparse_repl(struct optparse_cmd *cmd, FILE *stream, char *prompt)
+{
+    return optparse_repl_r(&global_ctx, cmd, stream, prompt);
+}
 
-        // Adjust spacing before printing option's description.
-        if (len < divider_width) {
-            len += fprintf(stream, "%*c", divider_width - len, ' ');
+// Same as optparse_repl(), but keeps the parsing state in *ctx.
+int optparse_repl_r(struct optparse_ctx *ctx, struct optparse_cmd *cmd,
+    FILE *stream, char *prompt)
+{
+    struct optparse_arena arena = { 0 };
+    char *line = NULL;
+    size_t line_size = 0;
+
+    optparse_compile(cmd);
+    ctx->_arena = &arena;
+
+    for (;;) {
+        if (prompt) {
+            fputs(prompt, stdout);
+            fflush(stdout);
+        }
+        if (!read_line(stream, &line, &line_size)) {
+            break;
         }
 
-        // Print option's description.
-        if (opt->description) {
-            if (len > divider_width) {
-#if OPTPARSE_HELP_FLOATING_DESCRIPTIONS
-                blockprint(stream, opt->description, len, divider_width,
-                    OPTPARSE_HELP_MAX_LINE_WIDTH);
-#else
-                fprintf(stream, "\n%*c", divider_width, ' ');
-                blockprint(stream, opt->description, divider_width,
-                    divider_width, OPTPARSE_HELP_MAX_LINE_WIDTH);
+        arena_reset(&arena);
+#if OPTPARSE_CONVERSION_CACHE
+        release_cache_maps(ctx);
 #endif
-            } else {
-                blockprint(stream, opt->description, divider_width,
-                    divider_width, OPTPARSE_HELP_MAX_LINE_WIDTH);
-            }
-        } else {
-            fprintf(stream, "\n");
+        char **argv = arena_alloc(&arena,
+            ((strlen(line) + 1) / 2 + 2) * sizeof (char *));
+        if (argv == NULL) {
+            optparse_error(NULL, "Out of memory.\n");
+        }
+        argv[0] = cmd->name; // Acts as the program's file name.
+        int argc = split_line(line, argv + 1) + 1;
+        if (argc == 1) {
+            continue;
         }
 
-        opt++;
+        parse_line(ctx, cmd, argc, argv);
     }
+
+    ctx->_arena = NULL;
+    arena_free(&arena);
+#if OPTPARSE_CONVERSION_CACHE
+    release_cache_maps(ctx);
+#endif
+    free(line);
+    return ferror(stream) ? -1 : 0;
 }
+#endif
 
-#if OPTPARSE_SUBCOMMANDS
-// Prints a list of a command's subcommands.
-static void print_subcommands(FILE *stream, struct optparse_cmd subcommands[])
+#if OPTPARSE_SERVER
+// Serves command lines sent by optparse_forward().
+int optparse_serve(struct optparse_cmd *cmd, const char *socket_path)
 {
-    struct optparse_cmd *subcmd;
-    int divider_width = 0;
+    struct sockaddr_un addr;
+    if (!make_address(&addr, socket_path)) {
+        return -1;
+    }
 
-    // Determine subcommand list's divider width.
-    subcmd = subcommands;
-    while (subcmd->name != END_OF_SUBCOMMANDS) {
-        int len = strlen(subcmd->name);
-        if (subcmd->operands) {
-            len += strlen(subcmd->operands) + 1;
-        }
-        if (len > divider_width) {
-            divider_width = len;
-        }
-        subcmd++;
+    // Compile before forking, so that connections share the indexes.
+    optparse_compile(cmd);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server == -1) {
+        return -1;
     }
-    divider_width += 2 * OPTPARSE_HELP_INDENTATION_WIDTH;
-    if (divider_width > OPTPARSE_HELP_MAX_DIVIDER_WIDTH) {
-        divider_width = OPTPARSE_HELP_MAX_DIVIDER_WIDTH;
+    remove_stale_socket(&addr);
+    if (bind(server, (struct sockaddr *) &addr, sizeof addr) == -1
+            || listen(server, SOMAXCONN) == -1) {
+        close(server);
+        return -1;
     }
 
-    // Print list of subcommands.
-    subcmd = subcommands;
-    while (subcmd->name != END_OF_SUBCOMMANDS) {
-        char buffer[OPTPARSE_PRINT_BUFFER_SIZE];
-        buffer[0] = '\0';
-        int n = bprintf(buffer, "%*c%s%s%s%*c",
-            OPTPARSE_HELP_INDENTATION_WIDTH, ' ',
-            subcmd->name,
-            subcmd->operands ? " " : "",
-            subcmd->operands ? subcmd->operands : "",
-            OPTPARSE_HELP_INDENTATION_WIDTH, ' ');
-        if (n < divider_width) {
-            bprintf(buffer, "%*c", divider_width - n, ' ');
-        }
-        fprintf(stream, "%s", buffer);
+    // Connection processes are reaped automatically.
+    signal(SIGCHLD, SIG_IGN);
 
-        if (subcmd->about) {
-            if (n > divider_width) {
-#if OPTPARSE_HELP_FLOATING_DESCRIPTIONS
-                blockprint(stream, subcmd->about, n, divider_width,
-                    OPTPARSE_HELP_MAX_LINE_WIDTH);
-#else
-                fprintf(stream, "\n%*c", divider_width, ' ');
-                blockprint(stream, subcmd->about, divider_width, divider_width,
-                    OPTPARSE_HELP_MAX_LINE_WIDTH);
-#endif
-            } else {
-                blockprint(stream, subcmd->about, divider_width, divider_width,
-                    OPTPARSE_HELP_MAX_LINE_WIDTH);
+    for (;;) {
+        int conn = accept(server, NULL, NULL);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
             }
-        } else {
-            fprintf(stream, "\n");
+            close(server);
+            return -1;
         }
 
-        subcmd++;
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(server);
+            signal(SIGCHLD, SIG_DFL);
+            handle_connection(cmd, conn);
+        }
+        close(conn);
     }
 }
-#endif
 
-// Prints a command's complete help information: about, usage, description,
-// options, subcommands.
-// cmd_chain: a NULL-terminated array that contains a valid command chain
-static void print_help(FILE *stream, struct optparse_cmd *cmd, int exit_status, bool noExit)
+// Runs a command line in a server started by optparse_serve().
+int optparse_forward(const char *socket_path, int argc, char **argv)
 {
-    if (stream != stderr && cmd->about) {
-        blockprint(stream, cmd->about, 0, 0, OPTPARSE_HELP_MAX_LINE_WIDTH);
+    struct sockaddr_un addr;
+    if (!make_address(&addr, socket_path)) {
+        return -1;
     }
 
-    // Print command's usage.
-    print_usage(stream, cmd);
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn == -1) {
+        return -1;
+    }
+    if (connect(conn, (struct sockaddr *) &addr, sizeof addr) == -1) {
+        close(conn);
+        return -1;
+    }
 
-    // Print command's description.
-    if (cmd->description) {
-        fprintf(stream, "\n");
-        blockprint(stream, cmd->description, 0, 0,
-            OPTPARSE_HELP_MAX_LINE_WIDTH);
+    int exit_status;
+    if (!send_request(conn, argc, argv)
+            || !read_all(conn, &exit_status, sizeof exit_status)) {
+        exit_status = EXIT_FAILURE;
     }
 
-    // Print command's options.
-    if (cmd->options) {
-#if OPTPARSE_HELP_LETTER_CASE == 0
-        fprintf(stream, "\nOptions:\n");
-#elif OPTPARSE_HELP_LETTER_CASE == 1
-        fprintf(stream, "\noptions:\n");
-#elif OPTPARSE_HELP_LETTER_CASE == 2
-        fprintf(stream, "\nOPTIONS:\n");
+    close(conn);
+    return exit_status;
+}
+#endif
+
+// Builds the lookup indexes of a command tree.
+void optparse_compile(struct optparse_cmd *cmd)
+{
+    compile_cmd(cmd);
+}
+
+// Adds an option to a command at runtime.
+void optparse_cmd_add_option(struct optparse_cmd *cmd, struct optparse_opt *opt)
+{
+#ifndef NDEBUG
+    check_opt(opt);
+#endif
+
+    compile_cmd(cmd);
+    index_option(cmd->_index, opt);
+}
+
+#if OPTPARSE_SUBCOMMANDS
+// Adds a subcommand to a command at runtime.
+void optparse_cmd_add_subcommand(struct optparse_cmd *cmd,
+    struct optparse_cmd *subcmd)
+{
+    compile_cmd(cmd);
+    index_subcommand(cmd, subcmd);
+}
 #endif
-        print_options(stream, cmd->options);
+
+// Recursively frees the lookup indexes of a command tree.
+void optparse_free(struct optparse_cmd *cmd)
+{
+    if (!cmd->_index) {
+        return;
     }
 
 #if OPTPARSE_SUBCOMMANDS
-    // Print list of subcommands.
-    if (cmd->subcommands) {
-#if OPTPARSE_HELP_LETTER_CASE == 0
-        fprintf(stream, "\nCommands:\n");
-#elif OPTPARSE_HELP_LETTER_CASE == 1
-        fprintf(stream, "\ncommands:\n");
-#elif OPTPARSE_HELP_LETTER_CASE == 2
-        fprintf(stream, "\nCOMMANDS:\n");
+    for (size_t i = 0; i < cmd->_index->subcmds.count; i++) {
+        optparse_free(cmd->_index->subcmds.items[i]);
+    }
+    free(cmd->_index->subcmds.items);
+    free(cmd->_index->subcmd_names.slots);
+#endif
+#if OPTPARSE_LONG_OPTIONS
+    free(cmd->_index->long_opts.slots);
 #endif
-        print_subcommands(stream, cmd->subcommands);
+#if OPTPARSE_SUBOPTIONS
+    for (size_t i = 0; i < cmd->_index->opts.count; i++) {
+        struct optparse_opt *opt = cmd->_index->opts.items[i];
+        if (opt->_subopt_index) {
+            free(opt->_subopt_index->keys.slots);
+            free(opt->_subopt_index);
+            opt->_subopt_index = NULL;
+        }
     }
 #endif
+    free(cmd->_index->opts.items);
+    free(cmd->_index);
+    cmd->_index = NULL;
+}
 
-    if (!noExit)
-        exit(exit_status);
+#if OPTPARSE_PROFILE
+// Writes the hit counts of a command tree's options to a stream.
+int optparse_profile_save(struct optparse_cmd *cmd, FILE *stream)
+{
+    save_profile(stream, cmd);
+    return ferror(stream) ? -1 : 0;
 }
 
-#if OPTPARSE_SUBCOMMANDS
-// Parses a command chain and returns the subcommmand the chain leads to.
-// Errors out if the chain is invalid.
-static struct optparse_cmd *read_cmd_chain(struct optparse_cmd *cmd,
-    char **argv)
+// Reads hit counts from a stream and reorders the command tree's indexes.
+int optparse_profile_load(struct optparse_cmd *cmd, FILE *stream)
 {
-    if (*argv && cmd->subcommands) {
-        struct optparse_cmd *subcmd = cmd->subcommands;
-        while (subcmd->name != END_OF_SUBCOMMANDS) {
-            if (strcmp(subcmd->name, *argv) == 0) {
-                return read_cmd_chain(subcmd, ++argv);
-            }
-            subcmd++;
+    optparse_compile(cmd);
+
+    char line[OPTPARSE_PRINT_BUFFER_SIZE];
+    while (fgets(line, sizeof line, stream)) {
+        char *end;
+        unsigned long hits = strtoul(line, &end, 10);
+        if (end == line) {
+            continue;
         }
 
-        optparse_error("Unknown command: \"%s\"\n", *argv);
-        return NULL; // To satisfy the compiler.
-    } else {
-        return cmd;
+        struct optparse_opt *opt = find_profiled_option(cmd, line);
+        if (opt) {
+            opt->_hits = hits;
+        }
     }
+
+#if OPTPARSE_LONG_OPTIONS
+    reorder_long_options(cmd);
+#endif
+
+    return ferror(stream) ? -1 : 0;
 }
 #endif
 
-#ifndef NDEBUG
-// Recursively checks a command's option structure for impossible/faulty setups.
-static void check_cmd(struct optparse_cmd *cmd)
+#if OPTPARSE_SCHEMA_EXPORT
+// Writes a command tree to a stream in JSON form.
+int optparse_export_json(struct optparse_cmd *cmd, FILE *stream)
 {
-    // The command's name is required.
-    assert(cmd->name != NULL);
+    optparse_compile(cmd);
+    export_json_cmd(stream, cmd);
+    putc('\n', stream);
+    return ferror(stream) ? -1 : 0;
+}
 
-    if (cmd->options) {
-        struct optparse_opt *opt = cmd->options;
-        while (opt->short_name != (char) END_OF_OPTIONS) {
-            // At least one of those is required.
-#if OPTPARSE_LONG_OPTIONS
-            assert(opt->short_name || opt->long_name);
-#else
-            assert(opt->short_name);
+// Writes a command tree to a stream in binary form.
+int optparse_export_binary(struct optparse_cmd *cmd, FILE *stream)
+{
+    optparse_compile(cmd);
+    fputs(SCHEMA_MAGIC, stream);
+    putc(SCHEMA_VERSION, stream);
+    export_binary_cmd(stream, cmd);
+    return ferror(stream) ? -1 : 0;
+}
 #endif
 
-            // Make sure option-argument is named properly.
-            assert((opt->arg_name && opt->arg_name[0] == '['
-                && opt->arg_name[strlen(opt->arg_name) - 1] == ']')
-                || (opt->arg_name && opt->arg_name[0] != '[')
-                || !opt->arg_name);
+#if OPTPARSE_TREE_STATS
+// Collects statistics on a command tree and its lookup indexes.
+void optparse_tree_stats(struct optparse_cmd *cmd,
+    struct optparse_tree_stats *stats)
+{
+    optparse_compile(cmd);
+    *stats = (struct optparse_tree_stats) { 0 };
+    add_cmd_stats(stats, cmd, 0);
+}
+#endif
 
-#if OPTPARSE_LIST_SUPPORT
-            // .arg_storage_size requires .arg_delim and .arg_storage.
-            assert((opt->arg_storage_size && opt->arg_delim && opt->arg_storage)
-                || !opt->arg_storage_size);
+#if OPTPARSE_CONVERSION_CACHE
+// Sets the directory optparse_parse() caches list conversions in.
+void optparse_set_cache_dir(char *dir)
+{
+    global_ctx.cache_dir = dir;
+}
+#endif
 
-            // Splitting and then calling like a non-array type-converted value
-            // existed would produce random values.
-            assert((opt->arg_delim && opt->function_type != FUNCTION_TYPE_TARG)
-                || !opt->arg_delim);
+#if OPTPARSE_CANONICAL_ARGV
+// Writes the canonical form of the most recently parsed command line to a
+// buffer.
+size_t optparse_canonical_argv(void *buffer, size_t size, int *argc,
+    char ***argv)
+{
+    return optparse_canonical_argv_r(&global_ctx, buffer, size, argc, argv);
+}
 
-            // If the option-argument is not split, no array exists and array
-            // functions must not be called.
-            assert((!opt->arg_delim && opt->function_type
-                != FUNCTION_TYPE_TARG_ARRAY && opt->function_type
-                != FUNCTION_TYPE_OARG_ARRAY) || opt->arg_delim);
-#endif
+// Same as optparse_canonical_argv(), but for the parsing process that uses
+// *ctx.
+size_t optparse_canonical_argv_r(struct optparse_ctx *ctx, void *buffer,
+    size_t size, int *argc, char ***argv)
+{
+    if (ctx->_operands == NULL) {
+        return 0;
+    }
 
-#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
-            // Group values must not be larger than
-            // OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX.
-            assert((opt->group && opt->group < OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX)
-                || !opt->group);
-#endif
+    if (ctx->_occurrence_count) {
+        qsort(ctx->_occurrences, ctx->_occurrence_count,
+            sizeof (struct optparse_occurrence), compare_occurrences);
+    }
 
-            opt++;
+    // Count the arguments and their size first.
+    struct canonical_writer w = { 0 };
+    for (int pass = 0; pass < 2; pass++) {
+        emit(&w, ctx->_operands[0], NULL, NULL, NULL);
+        emit_cmd(&w, ctx, ctx->_active_cmd);
+
+        bool separate = false;
+        for (int i = 1; i < ctx->_operand_count; i++) {
+            separate = separate || ctx->_operands[i][0] == '-';
+        }
+        if (separate) {
+            emit(&w, "--", NULL, NULL, NULL);
+        }
+        for (int i = 1; i < ctx->_operand_count; i++) {
+            emit(&w, ctx->_operands[i], NULL, NULL, NULL);
         }
-    }
 
-#if OPTPARSE_SUBCOMMANDS
-    if (cmd->subcommands) {
-        struct optparse_cmd *subcmd = cmd->subcommands;
-        while (subcmd->name != END_OF_SUBCOMMANDS) {
-            check_cmd(subcmd);
-            subcmd++;
+        size_t needed = (w.argc + 1) * sizeof (char *) + w.size;
+        if (pass == 1) {
+            w.argv[w.argc] = NULL;
+            *argc = (int) w.argc;
+            *argv = w.argv;
+        } else if (needed > size) {
+            return needed;
+        } else {
+            w = (struct canonical_writer) {
+                .argv = buffer,
+                .strings = (char *) buffer + (w.argc + 1) * sizeof (char *),
+            };
         }
     }
-#endif
+
+    return (w.argc + 1) * sizeof (char *) + w.size;
 }
 #endif
 
-/// Public functions -----------------------------------------------------------
-
-// Parses command line options as described in the provided command structure.
-void optparse_parse(struct optparse_cmd *cmd, int *argc, char ***argv)
+// Releases the memory a parse context has allocated for itself.
+void optparse_ctx_free(struct optparse_ctx *ctx)
 {
-#ifndef NDEBUG
-    check_cmd(cmd);
+#if OPTPARSE_CONVERSION_CACHE
+    release_cache_maps(ctx);
+    free(ctx->_cache_maps);
+    ctx->_cache_maps = NULL;
+    ctx->_cache_map_capacity = 0;
+#endif
+#if OPTPARSE_CANONICAL_ARGV
+    free(ctx->_occurrences);
+    free(ctx->_arg_copies);
+    ctx->_occurrences = NULL;
+    ctx->_occurrence_count = 0;
+    ctx->_occurrence_capacity = 0;
+    ctx->_arg_copies = NULL;
+    ctx->_arg_copies_size = 0;
+    ctx->_arg_copies_capacity = 0;
+#else
+    (void) ctx;
 #endif
-
-    help_stream = stdout;
-    optparse_main_cmd = cmd;
-    if (optparse_main_cmd) {
-        parse(argc, argv, optparse_main_cmd);
-    }
 }
 
 // Advances the parser index by 1 and returns the next command line argument.
 char *optparse_shift(void)
 {
-    if (args == NULL) {
+    return optparse_shift_r(calling_ctx());
+}
+
+// Undoes the previously called optparse_shift().
+char *optparse_unshift(void)
+{
+    return optparse_unshift_r(calling_ctx());
+}
+
+// Same as optparse_shift(), but for the parsing process that uses *ctx.
+char *optparse_shift_r(struct optparse_ctx *ctx)
+{
+    if (ctx->_args == NULL || ctx->_args_index >= ctx->_args_count) {
         return NULL;
     }
 
-    if (args[args_index] == NULL) {
+    if (++ctx->_args_index == ctx->_args_count) {
         return NULL;
     } else {
-        return args[++args_index];
+        return ctx->_args[ctx->_args_index];
     }
 }
 
-// Undoes the previously called optparse_shift().
-char *optparse_unshift(void)
+// Same as optparse_unshift(), but for the parsing process that uses *ctx.
+char *optparse_unshift_r(struct optparse_ctx *ctx)
 {
-    if (args == NULL) {
+    if (ctx->_args == NULL) {
         return NULL;
     }
 
-    if (args_index > 0) {
-        return args[--args_index];
+    if (ctx->_args_index > 0) {
+        return ctx->_args[--ctx->_args_index];
     } else {
         return NULL;
     }
@@ -1450,43 +4625,74 @@ char *optparse_unshift(void)
 // Prints the currently active command's help information.
 void optparse_print_help(bool noExit)
 {
-#if OPTPARSE_SUBCOMMANDS
-    print_help(help_stream, active_cmd, EXIT_SUCCESS, noExit);
-#else
-    print_help(help_stream, optparse_main_cmd, EXIT_SUCCESS, noExit);
-#endif
+    optparse_print_help_r(calling_ctx(), noExit);
 }
 
 // Same as optparse_print_help, but prints to the specified stream. Exits with
 // the provided exit status.
 void optparse_fprint_help(FILE *stream, int exit_status, bool noExit)
 {
-#if OPTPARSE_SUBCOMMANDS
-    print_help(stream, active_cmd, exit_status, noExit);
-#else
-    print_help(stream, optparse_main_cmd, exit_status, noExit);
-#endif
+    optparse_fprint_help_r(calling_ctx(), stream, exit_status, noExit);
 }
 
 // Prints the currently active command's usage information only.
 void optparse_fprint_usage(FILE *stream)
 {
-#if OPTPARSE_SUBCOMMANDS
-    print_usage(stream, active_cmd);
-#else
-    print_usage(stream, optparse_main_cmd);
-#endif
+    optparse_fprint_usage_r(calling_ctx(), stream);
+}
+
+// Same as optparse_print_help(), but for the parsing process that uses *ctx.
+void optparse_print_help_r(struct optparse_ctx *ctx, bool noExit)
+{
+    optparse_fprint_help_r(ctx, stdout, EXIT_SUCCESS, noExit);
+}
+
+// Same as optparse_fprint_help(), but for the parsing process that uses *ctx.
+void optparse_fprint_help_r(struct optparse_ctx *ctx, FILE *stream,
+    int exit_status, bool noExit)
+{
+    if (ctx->_active_cmd == NULL) {
+        return;
+    }
+
+    print_help(ctx, stream, ctx->_active_cmd, exit_status, noExit);
+}
+
+// Same as optparse_fprint_usage(), but for the parsing process that uses *ctx.
+void optparse_fprint_usage_r(struct optparse_ctx *ctx, FILE *stream)
+{
+    if (ctx->_active_cmd == NULL) {
+        return;
+    }
+
+    print_usage(stream, ctx->_active_cmd);
+}
+
+// Same as optparse_print_help(false), but can be used as a context-aware
+// function (FUNCTION_TYPE_CTX_VOID).
+void optparse_print_help_ctx(struct optparse_ctx *ctx, void *userdata)
+{
+    (void) userdata;
+    optparse_print_help_r(ctx, false);
 }
 
 #if OPTPARSE_SUBCOMMANDS
-static inline void __optparse_print_help_subcmd(int argc, char **argv, bool noExit) {
-    (void) argc; // To avoid compilers complaining about "unused parameter".
-    argv++; // To ignore the program's file name
-    if (*argv) {
-        struct optparse_cmd *subcmd = read_cmd_chain(optparse_main_cmd, argv);
-        print_help(stdout, subcmd, EXIT_SUCCESS, noExit);
+static void print_help_subcmd(struct optparse_ctx *ctx, int argc, char **argv,
+    bool noExit)
+{
+    if (ctx->_main_cmd == NULL) {
+        return;
+    }
+
+    // Ignore the program's file name.
+    argc--;
+    argv++;
+    if (argc > 0) {
+        struct optparse_cmd *subcmd = read_cmd_chain(ctx, ctx->_main_cmd, argc,
+            argv);
+        print_help(ctx, stdout, subcmd, EXIT_SUCCESS, noExit);
     } else {
-        print_help(stdout, optparse_main_cmd, EXIT_SUCCESS, noExit);
+        print_help(ctx, stdout, ctx->_main_cmd, EXIT_SUCCESS, noExit);
     }
 }
 
@@ -1494,12 +4700,91 @@ static inline void __optparse_print_help_subcmd(int argc, char **argv, bool noEx
 // command structure's .function member.
 void optparse_print_help_subcmd(int argc, char **argv)
 {
-    __optparse_print_help_subcmd(argc, argv, false);
+    print_help_subcmd(calling_ctx(), argc, argv, false);
 }
 
 void optparse_print_help_subcmd_noexit(int argc, char **argv)
 {
-    __optparse_print_help_subcmd(argc, argv, true);
+    print_help_subcmd(calling_ctx(), argc, argv, true);
+}
+
+// Same as optparse_print_help_subcmd(), but to be used as a command
+// structure's .ctx_function member.
+void optparse_print_help_subcmd_ctx(struct optparse_ctx *ctx, void *userdata,
+    int argc, char **argv)
+{
+    (void) userdata;
+    print_help_subcmd(ctx, argc, argv, false);
+}
+#endif
+
+// Recognizes a case-insensitive boolean keyword ("true", "false", "enabled",
+// "disabled", "yes", "no", "on", "off") without copying the string. At most 9
+// characters are read.
+// Return value: true if a keyword was recognized and stored in *x
+static bool strtobool(const char *str, bool *x)
+{
+    static const struct {
+        const char *keyword;
+        bool value;
+    } keywords[][2] = {
+        [2] = { { "no", false }, { "on", true } },
+        [3] = { { "yes", true }, { "off", false } },
+        [4] = { { "true", true } },
+        [5] = { { "false", false } },
+        [7] = { { "enabled", true } },
+        [8] = { { "disabled", false } },
+    };
+
+    size_t len = 0;
+    while (str[len] != '\0') {
+        if (++len == sizeof keywords / sizeof keywords[0]) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < 2 && keywords[len][i].keyword; i++) {
+        const char *keyword = keywords[len][i].keyword;
+        size_t n = 0;
+        while (n < len && lower(str[n]) == keyword[n]) {
+            n++;
+        }
+        if (n == len) {
+            *x = keywords[len][i].value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#if OPTPARSE_LIST_SUPPORT
+// Returns whether a sorted list of integers contains a value.
+bool optparse_list_contains(const void *array, size_t count,
+    enum optparse_data_type data_type, const void *value)
+{
+    if (count == 0 || !is_integer_type(data_type)) {
+        return false;
+    }
+
+    size_t size = get_data_type_size(data_type);
+    bool is_signed = is_signed_type(data_type);
+    bool little_endian = is_little_endian();
+    unsigned long long key = get_sort_key(value, size, is_signed,
+        little_endian);
+
+    // Narrow the range down to the last item not greater than the value. The
+    // comparison selects the offset arithmetically instead of branching, which
+    // avoids mispredictions on large lists.
+    const unsigned char *base = array;
+    while (count > 1) {
+        size_t half = count / 2;
+        const unsigned char *middle = base + half * size;
+        base += (get_sort_key(middle, size, is_signed, little_endian) <= key)
+            * half * size;
+        count -= half;
+    }
+    return get_sort_key(base, size, is_signed, little_endian) == key;
 }
 #endif
 
@@ -1524,19 +4809,19 @@ int strtox(char *str, void *x, enum optparse_data_type data_type)
             *(char **) x = str;
             break;
         case DATA_TYPE_CHAR:
-            if (strlen(str) > 1) {
+            if (str[0] != '\0' && str[1] != '\0') {
                 errno = ERANGE;
             }
             *(char *) x = str[0];
             break;
         case DATA_TYPE_SCHAR:
-            if (strlen(str) > 1) {
+            if (str[0] != '\0' && str[1] != '\0') {
                 errno = ERANGE;
             }
             *(signed char *) x = str[0];
             break;
         case DATA_TYPE_UCHAR:
-            if (strlen(str) > 1) {
+            if (str[0] != '\0' && str[1] != '\0') {
                 errno = ERANGE;
             }
             *(unsigned char *) x = str[0];
@@ -1607,37 +4892,12 @@ int strtox(char *str, void *x, enum optparse_data_type data_type)
             break;
 #endif
         case DATA_TYPE_BOOL:
-            {
-                int len = strlen(str);
-                char temp[len + 1];
-                strcpy(temp, str);
-                for (int i = 0; i < len; i++) {
-                    temp[i] = tolower(temp[i]);
-                }
-                if (strcmp(temp, "true") == 0) {
-                    *(bool *) x = true;
-                } else if (strcmp(temp, "false") == 0) {
-                    *(bool *) x = false;
-                } else if (strcmp(temp, "enabled") == 0) {
-                    *(bool *) x = true;
-                } else if (strcmp(temp, "disabled") == 0) {
-                    *(bool *) x = false;
-                } else if (strcmp(temp, "yes") == 0) {
-                    *(bool *) x = true;
-                } else if (strcmp(temp, "no") == 0) {
-                    *(bool *) x = false;
-                } else if (strcmp(temp, "on") == 0) {
-                    *(bool *) x = true;
-                } else if (strcmp(temp, "off") == 0) {
-                    *(bool *) x = false;
-                } else {
-                    int result = strtox(str, x, DATA_TYPE_INT);
-                    if (result == 1 || result == 0) {
-                        *(bool *) x = result;
-                    } else {
-                        endptr = str;
-                    }
+            if (!strtobool(str, x)) {
+                long result = strtol(str, &endptr, 0);
+                if (result != 0 && result != 1) {
+                    errno = ERANGE;
                 }
+                *(bool *) x = result;
             }
             break;
 #if OPTPARSE_C99_INTEGER_TYPES_SUPPORT
@@ -1724,3 +4984,66 @@ int strtox(char *str, void *x, enum optparse_data_type data_type)
         return 0;
     }
 }
+
+// Converts an array of strings to an array of different data type.
+int strtox_array(char **strs, size_t count, void *x,
+    enum optparse_data_type data_type, size_t *error_index)
+{
+    int size = get_data_type_size(data_type);
+    if (size == 0) { // Not a data type (of the enabled features).
+        if (error_index) {
+            *error_index = 0;
+        }
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int ret = strtox(strs[i], (char *) x + i * size, data_type);
+        if (ret) {
+            if (error_index) {
+                *error_index = i;
+            }
+            return ret;
+        }
+    }
+    return 0;
+}
+
+// Converts an array of string slices to an array of different data type.
+int strtox_slices(const struct optparse_slice *slices, size_t count, void *x,
+    enum optparse_data_type data_type, size_t *error_index)
+{
+    // Strings would point to the temporary copies of the slices.
+    int size = get_data_type_size(data_type);
+    if (data_type == DATA_TYPE_STR || size == 0) {
+        if (error_index) {
+            *error_index = 0;
+        }
+        return 1;
+    }
+
+    char buffer[64];
+    for (size_t i = 0; i < count; i++) {
+        // strtox() needs a terminated string. Numbers and keywords are short,
+        // so the slice is usually copied to the stack.
+        size_t length = slices[i].length;
+        char *str = length < sizeof buffer ? buffer : malloc(length + 1);
+        if (str == NULL) {
+            optparse_error(NULL, "Out of memory.\n");
+        }
+        memcpy(str, slices[i].str, length);
+        str[length] = '\0';
+
+        int ret = strtox(str, (char *) x + i * size, data_type);
+        if (str != buffer) {
+            free(str);
+        }
+        if (ret) {
+            if (error_index) {
+                *error_index = i;
+            }
+            return ret;
+        }
+    }
+    return 0;
+}
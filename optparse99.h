@@ -29,6 +29,7 @@ SOFTWARE.
 #ifndef OPTPARSE99_H
 #define OPTPARSE99_H
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -43,6 +44,12 @@ SOFTWARE.
 #define OPTPARSE_SUBCOMMANDS true
 #endif
 
+// Makes long options and subcommands case-insensitive (ASCII letters only).
+// Default value: false
+#ifndef OPTPARSE_CASE_INSENSITIVE
+#define OPTPARSE_CASE_INSENSITIVE false
+#endif
+
 #ifndef OPTPARSE_ATTACHED_OPTION_ARGUMENTS
 #define OPTPARSE_ATTACHED_OPTION_ARGUMENTS true
 #endif
@@ -55,10 +62,39 @@ SOFTWARE.
 #define OPTPARSE_HIDDEN_OPTIONS true
 #endif
 
+#ifndef OPTPARSE_OPTION_ALIASES
+#define OPTPARSE_OPTION_ALIASES true
+#endif
+
+#ifndef OPTPARSE_BIT_FLAGS
+#define OPTPARSE_BIT_FLAGS true
+#endif
+
 #ifndef OPTPARSE_LIST_SUPPORT
 #define OPTPARSE_LIST_SUPPORT true
 #endif
 
+// Enables optparse_repl(), which parses lines read from a stream like command
+// lines, without exiting on errors.
+// Default value: false
+#ifndef OPTPARSE_REPL
+#define OPTPARSE_REPL false
+#endif
+
+// Enables optparse_serve() and optparse_forward(), which run command lines in a
+// resident server process. Requires POSIX sockets and processes.
+// Default value: false
+#ifndef OPTPARSE_SERVER
+#define OPTPARSE_SERVER false
+#endif
+
+// Allows option functions to be deferred and run concurrently after parsing.
+// Requires POSIX threads.
+// Default value: false
+#ifndef OPTPARSE_DEFERRED_CALLBACKS
+#define OPTPARSE_DEFERRED_CALLBACKS false
+#endif
+
 #ifndef OPTPARSE_FLOATING_POINT_SUPPORT
 #define OPTPARSE_FLOATING_POINT_SUPPORT true
 #endif
@@ -143,6 +179,86 @@ SOFTWARE.
 #define OPTPARSE_PRINT_BUFFER_SIZE 1024
 #endif
 
+// Counts how often each option is used, so that the counts can be saved to and
+// loaded from a profile (see optparse_profile_save()).
+// Default value: false
+#ifndef OPTPARSE_PROFILE
+#define OPTPARSE_PROFILE false
+#endif
+
+// Records the options used while parsing, so that the command line can be
+// rebuilt in a canonical form (see optparse_canonical_argv()).
+// Default value: false
+#ifndef OPTPARSE_CANONICAL_ARGV
+#define OPTPARSE_CANONICAL_ARGV false
+#endif
+
+// Allows parse contexts to collect recoverable parsing errors in an array
+// instead of quitting on the first one (see struct optparse_ctx).
+// Default value: false
+#ifndef OPTPARSE_COLLECT_ERRORS
+#define OPTPARSE_COLLECT_ERRORS false
+#endif
+
+// Allows options to have option-arguments that consist of comma-separated
+// keys and values (see .suboptions).
+// Default value: false
+#ifndef OPTPARSE_SUBOPTIONS
+#define OPTPARSE_SUBOPTIONS false
+#endif
+
+// Enables optparse_export_json() and optparse_export_binary(), which export a
+// whole command tree for external tools.
+// Default value: false
+#ifndef OPTPARSE_SCHEMA_EXPORT
+#define OPTPARSE_SCHEMA_EXPORT false
+#endif
+
+// Enables optparse_tree_stats(), which reports the size of a command tree and
+// the efficiency of its lookup indexes.
+// Default value: false
+#ifndef OPTPARSE_TREE_STATS
+#define OPTPARSE_TREE_STATS false
+#endif
+
+// Caches converted list option-arguments in files that are mapped into memory
+// when the same list is parsed again (see optparse_set_cache_dir()). Requires
+// OPTPARSE_LIST_SUPPORT and POSIX mmap().
+// Default value: false
+#ifndef OPTPARSE_CONVERSION_CACHE
+#define OPTPARSE_CONVERSION_CACHE false
+#endif
+#if !OPTPARSE_LIST_SUPPORT
+#undef OPTPARSE_CONVERSION_CACHE
+#define OPTPARSE_CONVERSION_CACHE false
+#endif
+
+// The maximum number of errors a parse context stores if it collects errors.
+// Default value: 16
+#ifndef OPTPARSE_DIAGNOSTICS_MAX
+#define OPTPARSE_DIAGNOSTICS_MAX 16
+#endif
+
+// The minimum size of list option-arguments, in bytes, to be cached. Smaller
+// lists are converted faster than they are looked up.
+// Default value: 4096
+#ifndef OPTPARSE_CONVERSION_CACHE_MIN_SIZE
+#define OPTPARSE_CONVERSION_CACHE_MIN_SIZE 4096
+#endif
+
+// The number of command levels optparse_tree_stats() reports separately.
+// Deeper levels are added to the last one.
+// Default value: 8
+#ifndef OPTPARSE_TREE_STATS_LEVELS_MAX
+#define OPTPARSE_TREE_STATS_LEVELS_MAX 8
+#endif
+
+// The maximum number of threads deferred option functions are run on.
+// Default value: 4
+#ifndef OPTPARSE_DEFERRED_THREADS_MAX
+#define OPTPARSE_DEFERRED_THREADS_MAX 4
+#endif
+
 /// Option structure -----------------------------------------------------------
 
 #define END_OF_OPTIONS -1 // Marks the end of an option array.
@@ -180,14 +296,44 @@ enum optparse_data_type {
 #endif
 };
 
-// Specifies what to do with the integer variable .flag points to.
+// Specifies what to do with the integer variable .flag points to (or with the
+// bit flag .flag_bit refers to).
 enum optparse_flag_type {
     FLAG_TYPE_SET_TRUE,  // Set to 1 (default)
     FLAG_TYPE_SET_FALSE, // Set to 0
-    FLAG_TYPE_INCREMENT, // Increase by 1
-    FLAG_TYPE_DECREMENT, // Decrease by 1
+    FLAG_TYPE_INCREMENT, // Increase by 1 (integer flags only)
+    FLAG_TYPE_DECREMENT, // Decrease by 1 (integer flags only)
+    FLAG_TYPE_TOGGLE,    // Set to 1 if 0, otherwise set to 0
+};
+
+#if OPTPARSE_BIT_FLAGS
+// The number of bit flags an element of a .flag_words array holds.
+#define OPTPARSE_FLAG_WORD_BITS (CHAR_BIT * sizeof (unsigned long))
+
+// The number of elements a .flag_words array needs to hold n bit flags.
+#define OPTPARSE_FLAG_WORDS(n) \
+    (((n) + OPTPARSE_FLAG_WORD_BITS - 1) / OPTPARSE_FLAG_WORD_BITS)
+
+// Returns the state (0 or 1) of bit flag n in a .flag_words array.
+#define OPTPARSE_FLAG_TEST(words, n) \
+    (((words)[(n) / OPTPARSE_FLAG_WORD_BITS] >> ((n) % OPTPARSE_FLAG_WORD_BITS)) \
+    & 1UL)
+#endif
+
+// Specifies how the memory locations in .arg_storage, .arg_storage_size, .flag
+// and .flag_words are to be interpreted.
+enum optparse_storage_type {
+    STORAGE_TYPE_ABSOLUTE, // Pointers to variables (default)
+    STORAGE_TYPE_OFFSET,   // Byte offsets created by OPTPARSE_OFFSET(), relative
+                           // to the parse context's .base member
 };
 
+// Converts a structure member's byte offset to a value that can be assigned to
+// .arg_storage, .arg_storage_size, .flag and .flag_words if .storage_type is
+// STORAGE_TYPE_OFFSET, e.g.:
+//     .arg_storage = OPTPARSE_OFFSET(struct config, level),
+#define OPTPARSE_OFFSET(type, member) ((void *) (offsetof(type, member) + 1))
+
 // Specifies how the function pointed to by .function is expected to be declared
 // and, internally, going to be called.
 enum optparse_function_type {
@@ -211,13 +357,57 @@ enum optparse_function_type {
 #endif
     FUNCTION_TYPE_VOID,       // declaration: void f(void);
                               // call:        f();
+    FUNCTION_TYPE_CTX_VOID,   // Context-aware variants (see optparse_parse_r()):
+                              // declaration: void f(struct optparse_ctx *,
+                              //                  void *);
+                              // call:        f(CTX, .userdata);
+    FUNCTION_TYPE_CTX_TARG,   // declaration: void f(struct optparse_ctx *,
+                              //                  void *, void *);
+                              // call:        f(CTX, .userdata, &TARG);
+    FUNCTION_TYPE_CTX_OARG,   // declaration: void f(struct optparse_ctx *,
+                              //                  void *, char *);
+                              // call:        f(CTX, .userdata, OARG);
+#if OPTPARSE_LIST_SUPPORT
+    FUNCTION_TYPE_CTX_TARG_ARRAY,
+                              // declaration: void f(struct optparse_ctx *,
+                              //                  void *, size_t, void *);
+                              // call:        f(CTX, .userdata,
+                              //                  TARG_ARRAY_SIZE, TARG_ARRAY);
+#endif
 };
 
+struct optparse_ctx;
+
+#if OPTPARSE_SUBOPTIONS
+#define END_OF_SUBOPTIONS NULL // Marks the end of a sub-option array.
+
+// Describes a key of an option-argument that consists of comma-separated keys
+// and values, e.g. "type=bind,src=/a,ro".
+struct optparse_subopt {
+    char *name;               // The key. (required)
+    enum optparse_data_type data_type;
+                              // The data type the key's value is converted to.
+    void *storage;            // The memory location the (type-converted) value
+                              // is saved to. If set, the key requires a value.
+    int *flag;                // If set, the integer variable is set to 1 if the
+                              // key is used.
+    char *description;        // The key's documentation.
+};
+#endif
+
 struct optparse_opt {
     char short_name;          // The short option character.
 #if OPTPARSE_LONG_OPTIONS
     char *long_name;          // The long option string, without leading "--".
                               // At least .short_name or .long_name must be set.
+#endif
+#if OPTPARSE_OPTION_ALIASES
+    char *short_aliases;      // A string of additional short option characters
+                              // that refer to this option, e.g. "jt".
+#if OPTPARSE_LONG_OPTIONS
+    char **long_aliases;      // A NULL-terminated array of additional long
+                              // option strings that refer to this option.
+#endif
 #endif
     char *arg_name;           // If set, it means the option has one or more
                               // option-arguments. The string is displayed as-is
@@ -240,16 +430,53 @@ struct optparse_opt {
 #if OPTPARSE_LIST_SUPPORT
     size_t *arg_storage_size; // The memory location the number of list items
                               // stored in *arg_storage is saved to.
+    _Bool arg_sorted;         // If true, the items of a list of integers are
+                              // sorted in ascending order, e.g. for
+                              // optparse_list_contains().
+#endif
+#if OPTPARSE_SUBOPTIONS
+    struct optparse_subopt *suboptions;
+                              // Points to an array of keys the option-argument
+                              // consists of. If set, the option-argument is
+                              // split at commas in place, into keys and values
+                              // separated by '=', which are stored as specified
+                              // by the array's elements. Their storage members
+                              // are interpreted according to .storage_type.
+                              // .arg_storage and .arg_delim must not be set.
 #endif
     int *flag;                // A pointer to an integer variable that is to be
                               // used as specified by .flag_type.
     enum optparse_flag_type flag_type;
+#if OPTPARSE_BIT_FLAGS
+    unsigned long *flag_words;
+                              // A pointer to an array of packed bit flags, of
+                              // which the bit with index .flag_bit is to be
+                              // used as specified by .flag_type. Can be used
+                              // instead of .flag.
+    unsigned int flag_bit;
+#endif
+    enum optparse_storage_type storage_type;
+                              // If set to STORAGE_TYPE_OFFSET, .arg_storage,
+                              // .arg_storage_size, .flag and .flag_words are
+                              // offsets into the object the parse context's
+                              // .base member points to.
     void (*function)(void);   // Points to a function that is called as
                               // specified in .function_type. In the struct's
                               // initializer, the pointer can be cast to a void
                               // function pointer to avoid compiler warnings:
                               // .function = (void (*)(void)) function_name;
     enum optparse_function_type function_type;
+    void *userdata;           // Passed to context-aware functions.
+#if OPTPARSE_DEFERRED_CALLBACKS
+    int deferred;             // If greater than 0, .function is not called
+                              // during parsing, but afterwards, in stage
+                              // .deferred. Stages run in ascending order; the
+                              // functions of a stage run concurrently and all
+                              // of them finish before the next stage starts.
+                              // Deferred functions must not call functions
+                              // that use the parse context (optparse_shift(),
+                              // optparse_print_help(), etc.).
+#endif
 #if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
     int group;                // Options that share the same group value are
                               // treated as mutually exclusive.
@@ -260,6 +487,13 @@ struct optparse_opt {
 #endif
     char *description;        // A string that will appear as the option's
                               // documentation in the help screen.
+#if OPTPARSE_PROFILE
+    unsigned long _hits;      // Used internally to count the option's uses.
+#endif
+#if OPTPARSE_SUBOPTIONS
+    struct optparse_subopt_index *_subopt_index;
+                              // Used internally to look up sub-options by key.
+#endif
 };
 
 /// Command structure ----------------------------------------------------------
@@ -278,23 +512,251 @@ struct optparse_cmd {
     char *usage;       // Used to override automatic usage generation.
     void (*function)(int, char **);
                        // Called after parsing options/subcommands.
+    void (*ctx_function)(struct optparse_ctx *, void *, int, char **);
+                       // Same as .function, but context-aware: it is called
+                       // with the parse context and .userdata as additional
+                       // arguments. Only one of both may be set.
+    void *userdata;    // Passed to .ctx_function.
     struct optparse_opt *options;
                        // Points to an array containing the command's options.
+    _Bool stop_at_operand;
+                       // If true, options are only recognized until the first
+                       // operand (or "--"), like POSIX requires. All remaining
+                       // arguments are passed to the command's function as
+                       // they are, without examining or copying them. Ignored
+                       // if the command has subcommands.
 #if OPTPARSE_SUBCOMMANDS
     struct optparse_cmd *subcommands;
                        // Points to an array containing the command's
                        // subcommands.
+    void (*provider)(struct optparse_cmd *);
+                       // If set, called the first time the command is
+                       // selected to fill in .options and .subcommands (e.g.
+                       // by loading a plugin). Until then, only the command's
+                       // other members are used, e.g. in help screens.
     struct optparse_cmd *_parent;
                        // Used internally to keep track of nested subcommands.
 #endif
+    struct optparse_index *_index;
+                       // Used internally to look up options by name.
+};
+
+/// Parse context structure ----------------------------------------------------
+
+#if OPTPARSE_COLLECT_ERRORS
+// Specifies the kind of a collected parsing error.
+enum optparse_diagnostic_type {
+    DIAGNOSTIC_TYPE_UNKNOWN_OPTION,     // Unknown (short or long) option
+    DIAGNOSTIC_TYPE_UNKNOWN_COMMAND,    // Unknown subcommand
+    DIAGNOSTIC_TYPE_MISSING_ARGUMENT,   // Required option-argument missing
+    DIAGNOSTIC_TYPE_UNWANTED_ARGUMENT,  // Option-argument given to an option
+                                        // that doesn't take one
+    DIAGNOSTIC_TYPE_INVALID_ARGUMENT,   // Option-argument (or list item) not
+                                        // convertible
+    DIAGNOSTIC_TYPE_OUT_OF_RANGE,       // Converted option-argument (or list
+                                        // item) out of range
+    DIAGNOSTIC_TYPE_MUTUALLY_EXCLUSIVE, // Option conflicts with an option
+                                        // used before
 };
 
+// A collected parsing error.
+struct optparse_diagnostic {
+    enum optparse_diagnostic_type type;
+    int arg_index;     // The index of the offending argument in the argv
+                       // passed to the parsing function.
+};
+#endif
+
+// Holds the state of a single parsing process. A command tree can be shared by
+// any number of contexts, e.g. to run independent parses in multiple threads.
+// Initialize with { 0 } or designated initializers, e.g.:
+//     struct optparse_ctx ctx = { .userdata = &config };
+struct optparse_ctx {
+    void *userdata;    // Passed to context-aware functions.
+    void *base;        // The object options with .storage_type
+                       // STORAGE_TYPE_OFFSET write to.
+#if OPTPARSE_COLLECT_ERRORS
+    bool collect_errors;
+                       // If true, parsing doesn't quit on recoverable errors,
+                       // but skips the offending arguments and stores the
+                       // errors in .diagnostics. Nothing is printed, and the
+                       // command's function is not called if there were
+                       // errors. Option functions are still called.
+    struct optparse_diagnostic diagnostics[OPTPARSE_DIAGNOSTICS_MAX];
+                       // The first OPTPARSE_DIAGNOSTICS_MAX errors, in
+                       // command line order.
+    size_t diagnostic_count;
+                       // The number of errors, which can be greater than
+                       // OPTPARSE_DIAGNOSTICS_MAX.
+#endif
+#if OPTPARSE_CONVERSION_CACHE
+    char *cache_dir;   // If not NULL, the directory converted lists are
+                       // cached in.
+#endif
+    struct optparse_cmd *_main_cmd;
+                       // Used internally to keep track of the parsing state.
+    struct optparse_cmd *_active_cmd;
+    char **_args;
+    int _args_index;
+    int _args_count;
+    char **_args_end;  // The end of the window passed to the parsing function,
+                       // which argv may be terminated before.
+#if OPTPARSE_COLLECT_ERRORS
+    int _args_offset;  // The index of _args[0] in the original argv.
+#endif
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+    struct optparse_opt *_exclusive_opts[OPTPARSE_MUTUALLY_EXCLUSIVE_GROUPS_MAX];
+#endif
+#if OPTPARSE_REPL
+    struct optparse_arena *_arena;
+    void *_exit_jmp;
+#endif
+#if OPTPARSE_DEFERRED_CALLBACKS
+    struct optparse_call *_deferred_calls;
+    size_t _deferred_count;
+    size_t _deferred_capacity;
+#endif
+#if OPTPARSE_CONVERSION_CACHE
+    void **_cache_maps;
+                       // Arrays mapped from the cache and stored in
+                       // .arg_storage, unmapped by optparse_ctx_free().
+    size_t _cache_map_count;
+    size_t _cache_map_capacity;
+#endif
+#if OPTPARSE_CANONICAL_ARGV
+    struct optparse_occurrence *_occurrences;
+    size_t _occurrence_count;
+    size_t _occurrence_capacity;
+    char *_arg_copies;
+    size_t _arg_copies_size;
+    size_t _arg_copies_capacity;
+    char **_operands;
+    int _operand_count;
+#endif
+};
+
+#if OPTPARSE_TREE_STATS
+/// Tree statistics structure --------------------------------------------------
+
+// Statistics on all name tables of one kind, e.g. the long option tables of all
+// commands.
+struct optparse_table_stats {
+    size_t table_count;
+    size_t entry_count;      // The number of names stored in the tables.
+    size_t slot_count;       // The number of slots of the tables.
+    double max_load_factor;  // The highest ratio of entries to slots.
+    size_t max_probe_length; // The highest number of slots examined to look up
+                             // a stored name.
+};
+
+// Statistics on a command tree, filled in by optparse_tree_stats().
+struct optparse_tree_stats {
+    size_t command_count;    // Including the root command.
+    size_t option_count;
+    size_t depth;            // The number of command levels.
+    size_t level_commands[OPTPARSE_TREE_STATS_LEVELS_MAX];
+    size_t level_options[OPTPARSE_TREE_STATS_LEVELS_MAX];
+                             // Command and option counts per level, starting
+                             // with the root command's.
+    size_t name_bytes;       // The size of all command, option, alias,
+                             // option-argument and sub-option names.
+    size_t description_bytes;
+                             // The size of all .about, .description, .operands
+                             // and .usage strings.
+    size_t index_bytes;      // The memory used by the lookup indexes.
+#if OPTPARSE_LONG_OPTIONS
+    struct optparse_table_stats long_options;
+#endif
+#if OPTPARSE_SUBCOMMANDS
+    struct optparse_table_stats subcommands;
+#endif
+#if OPTPARSE_SUBOPTIONS
+    struct optparse_table_stats suboptions;
+#endif
+};
+#endif
+
 /// Functions ------------------------------------------------------------------
 
+// Exports only the functions below when the library is built with hidden
+// symbol visibility (-fvisibility=hidden). The standard headers are included
+// above, outside of the push/pop pair.
+#if defined(__GNUC__)
+#pragma GCC visibility push(default)
+#endif
+
 // Parses command line options as specified in the command tree *cmd.
-// Modifies argc and argv to only contain non-option arguments.
+// Modifies argc and argv to only contain non-option arguments. Only the first
+// *argc elements of argv are parsed, which allows argv to be a slice of a larger
+// array that is not NULL-terminated; the resulting argv is NULL-terminated only
+// if that doesn't write past the slice.
 void optparse_parse(struct optparse_cmd *cmd, int *argc, char ***argv);
 
+// Builds the lookup indexes of the command tree *cmd. It is called
+// automatically by optparse_parse() and optparse_parse_r(), but must be called
+// manually before a command tree is used by multiple threads at once. After
+// that, optparse_parse_r() may be called concurrently with separate contexts.
+void optparse_compile(struct optparse_cmd *cmd);
+
+// Adds the option *opt to the command *cmd at runtime. The option structure is
+// referenced, not copied, and must outlive the command tree. Options added this
+// way are listed after the ones from .options.
+void optparse_cmd_add_option(struct optparse_cmd *cmd, struct optparse_opt *opt);
+
+#if OPTPARSE_SUBCOMMANDS
+// Adds the subcommand *subcmd to the command *cmd at runtime. Like options,
+// subcommand structures are referenced, not copied.
+void optparse_cmd_add_subcommand(struct optparse_cmd *cmd,
+    struct optparse_cmd *subcmd);
+#endif
+
+// Frees the lookup indexes of the command tree *cmd, including the ones of
+// options and subcommands added at runtime. Those have to be added again
+// afterwards.
+void optparse_free(struct optparse_cmd *cmd);
+
+// Same as optparse_parse(), but keeps all parsing state in *ctx instead of
+// global variables. Context-aware functions are called with ctx as their first
+// argument. Functions that are called during parsing can use optparse_shift(),
+// optparse_print_help() etc., which operate on the context the calling thread
+// is parsing with, or their _r variants.
+void optparse_parse_r(struct optparse_ctx *ctx, struct optparse_cmd *cmd,
+    int *argc, char ***argv);
+
+#if OPTPARSE_REPL
+// Reads lines from a stream until EOF and parses each line like a command line
+// (with the command tree *cmd), calling the functions of the options and
+// commands it contains. Arguments are separated by whitespace and can be
+// quoted. Instead of exiting, errors and help screens only end the parsing of
+// the current line. Memory needed while parsing a line (e.g. the argument
+// vector and lists) is reused for the next line, so list arrays stored in
+// .arg_storage are only valid until then. If prompt is not NULL, it is printed
+// to stdout before each line is read.
+// Return value:  0: end of stream
+//               -1: read error
+int optparse_repl(struct optparse_cmd *cmd, FILE *stream, char *prompt);
+
+// Same as optparse_repl(), but keeps all parsing state in *ctx.
+int optparse_repl_r(struct optparse_ctx *ctx, struct optparse_cmd *cmd,
+    FILE *stream, char *prompt);
+#endif
+
+#if OPTPARSE_SERVER
+// Turns the calling process into a server that listens on the UNIX socket
+// socket_path and runs the command lines sent by optparse_forward() with the
+// command tree *cmd, in a child process per connection, using the client's
+// working directory, stdin, stdout and stderr. The command's exit status is
+// sent back to the client. Doesn't return unless an error occurs.
+// Return value: -1 on error (errno is set)
+int optparse_serve(struct optparse_cmd *cmd, const char *socket_path);
+
+// Sends a command line to the server listening on the UNIX socket socket_path
+// and waits until the command has finished.
+// Return value: the command's exit status; -1 if there is no server (nothing
+//               has been run)
+int optparse_forward(const char *socket_path, int argc, char **argv);
+#endif
+
 // Prints the currently active command's full help information, listing
 // available options and their descriptions. It can be called manuall or through
 // an option's function member. Exits with exit status EXIT_SUCCESS.
@@ -307,12 +769,30 @@ void optparse_fprint_help(FILE *stream, int exit_status, bool noExit);
 // Prints the currently active command's usage information only.
 void optparse_fprint_usage(FILE *stream);
 
+// The functions above use the context that the calling thread is parsing
+// with, or the one of optparse_parse() if it isn't parsing. The _r variants
+// use the context *ctx, e.g. after optparse_parse_r() has returned. They print
+// nothing if no command has been parsed with the context.
+void optparse_print_help_r(struct optparse_ctx *ctx, bool noExit);
+void optparse_fprint_help_r(struct optparse_ctx *ctx, FILE *stream,
+    int exit_status, bool noExit);
+void optparse_fprint_usage_r(struct optparse_ctx *ctx, FILE *stream);
+
+// Same as optparse_print_help(false), but to be used as a context-aware
+// function (FUNCTION_TYPE_CTX_VOID).
+void optparse_print_help_ctx(struct optparse_ctx *ctx, void *userdata);
+
 #if OPTPARSE_SUBCOMMANDS
 // Prints a subcommand's help by parsing remaining operands. To be used as a
 // command structure's .function member.
 void optparse_print_help_subcmd(int argc, char **argv);
 
 void optparse_print_help_subcmd_noexit(int argc, char **argv);
+
+// Same as optparse_print_help_subcmd(), but to be used as a command
+// structure's .ctx_function member.
+void optparse_print_help_subcmd_ctx(struct optparse_ctx *ctx, void *userdata,
+    int argc, char **argv);
 #endif
 
 // Advances the parser's internal index and returns the next command line
@@ -325,6 +805,106 @@ char *optparse_shift(void);
 // guaranteed to undo the most recent shift.
 char *optparse_unshift(void);
 
+// Same as optparse_shift() and optparse_unshift(), but for the parsing process
+// that uses context *ctx.
+char *optparse_shift_r(struct optparse_ctx *ctx);
+char *optparse_unshift_r(struct optparse_ctx *ctx);
+
+#if OPTPARSE_PROFILE
+// Writes the hit counts of the command tree's options (how often each option
+// has been used) to a stream, one option per line, in the form:
+//     <hits> <command chain> <option name>
+// Return value:  0: success
+//               -1: write error
+int optparse_profile_save(struct optparse_cmd *cmd, FILE *stream);
+
+// Reads hit counts written by optparse_profile_save() and rebuilds the command
+// tree's long option indexes, so that the most used options are looked up
+// first. Lines that refer to unknown options are ignored.
+// Return value:  0: success
+//               -1: read error
+int optparse_profile_load(struct optparse_cmd *cmd, FILE *stream);
+#endif
+
+#if OPTPARSE_SCHEMA_EXPORT
+// Writes the command tree *cmd (including options added at runtime and
+// subcommands filled in by providers, which are called if necessary) to a
+// stream as a single JSON object, for tools like shell completion scripts and
+// documentation generators. See README.md for the format.
+// Return value:  0: success
+//               -1: write error
+int optparse_export_json(struct optparse_cmd *cmd, FILE *stream);
+
+// Same as optparse_export_json(), but writes the command tree in a compact
+// binary form. See README.md for the format.
+int optparse_export_binary(struct optparse_cmd *cmd, FILE *stream);
+#endif
+
+#if OPTPARSE_TREE_STATS
+// Fills in *stats with statistics on the command tree *cmd (including options
+// added at runtime and subcommands filled in by providers, which are called if
+// necessary), e.g. for capacity planning. Options used by multiple commands
+// are counted once per command.
+void optparse_tree_stats(struct optparse_cmd *cmd,
+    struct optparse_tree_stats *stats);
+#endif
+
+#if OPTPARSE_CONVERSION_CACHE
+// Makes optparse_parse() cache converted list option-arguments in the directory
+// dir (which must exist), so that parsing the same list again maps the
+// converted array from a file instead of converting each item. Lists of
+// strings and lists smaller than OPTPARSE_CONVERSION_CACHE_MIN_SIZE bytes are
+// not cached. While caching is enabled, list arrays stored in .arg_storage
+// must not be freed, as they may be mapped from a file; they remain valid until
+// the program exits. The parse context's .cache_dir member does the same for
+// optparse_parse_r().
+// If dir is NULL, caching is disabled (default).
+void optparse_set_cache_dir(char *dir);
+#endif
+
+#if OPTPARSE_CANONICAL_ARGV
+// Rebuilds the most recently parsed command line in a canonical form and
+// writes it to a buffer of the given size, suitably aligned for pointers (e.g.
+// allocated by malloc()): an argument vector (terminated by NULL), followed by
+// its strings. The options of each command are sorted by
+// name and use the long form where available. Repeated options whose effect is
+// overridden are merged, toggles that cancel each other out and flag-only
+// options that left their flag unchanged are omitted. Operands are preceded by
+// "--" if one of them starts with '-'. If the buffer is large enough, *argc and
+// *argv are set to the canonical command line. Should be called from a
+// command's function, as operands are only valid until parsing has finished.
+// Limitations: arguments consumed by an option function through
+// optparse_shift() are not reproduced, and options that modify the same
+// variable in different ways are reordered (only their names are compared).
+// Return value: the size the buffer needs to have (like snprintf(), nothing is
+//               written if it is larger than size); 0 if nothing was parsed
+size_t optparse_canonical_argv(void *buffer, size_t size, int *argc,
+    char ***argv);
+
+// Same as optparse_canonical_argv(), but for the parsing process that uses
+// context *ctx.
+size_t optparse_canonical_argv_r(struct optparse_ctx *ctx, void *buffer,
+    size_t size, int *argc, char ***argv);
+#endif
+
+// Releases the memory allocated by the parse context *ctx itself (e.g. for
+// optparse_canonical_argv()) and unmaps the list arrays it mapped from the
+// conversion cache. The context can be reused afterwards.
+void optparse_ctx_free(struct optparse_ctx *ctx);
+
+#if OPTPARSE_LIST_SUPPORT
+// Returns whether the list *array of count integers of type data_type, which
+// must be sorted in ascending order (see .arg_sorted), contains the integer
+// *value of the same type. Takes O(log count) time. Lists of other types never
+// contain anything.
+// Example:
+//     int port = 8080;
+//     bool allowed = optparse_list_contains(ports, port_count, DATA_TYPE_INT,
+//         &port);
+bool optparse_list_contains(const void *array, size_t count,
+    enum optparse_data_type data_type, const void *value);
+#endif
+
 // Converts a string to different data type. Can, for example, be used to
 // manually convert option-arguments retreived by optparse_shift().
 // Return value:  0: success
@@ -334,4 +914,32 @@ char *optparse_unshift(void);
 //     int i;
 //     int retval = strtox("512", &i, DATA_TYPE_INT);
 int strtox(char *str, void *x, enum optparse_data_type data_type);
+
+// Same as strtox(), but converts the count strings in strs to the array x,
+// whose element type must match data_type. Conversion stops at the first
+// string that fails, whose index is saved to *error_index unless error_index is
+// NULL. If data_type is not supported, 1 is returned and the index is 0.
+// Example:
+//     char *operands[] = { "1", "2", "3" };
+//     int numbers[3];
+//     size_t error_index;
+//     int retval = strtox_array(operands, 3, numbers, DATA_TYPE_INT,
+//         &error_index);
+int strtox_array(char **strs, size_t count, void *x,
+    enum optparse_data_type data_type, size_t *error_index);
+
+// A string that is not necessarily terminated, e.g. part of a larger buffer.
+struct optparse_slice {
+    const char *str;
+    size_t length;
+};
+
+// Same as strtox_array(), but converts string slices. DATA_TYPE_STR is not
+// supported (1 is returned).
+int strtox_slices(const struct optparse_slice *slices, size_t count, void *x,
+    enum optparse_data_type data_type, size_t *error_index);
+
+#if defined(__GNUC__)
+#pragma GCC visibility pop
+#endif
 #endif
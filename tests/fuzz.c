@@ -0,0 +1,468 @@
+// Fuzzes the parser with optparse_parse_r() (collecting errors instead of
+// quitting), the type conversion functions and list conversion.
+//
+// Built with clang and -fsanitize=fuzzer, this is a libFuzzer target. Otherwise
+// main() runs each file given as an argument (or stdin) as a single input, so
+// that AFL and crash reproduction work with any compiler.
+//
+// An input is split at NUL and newline characters into the arguments of a
+// command line. The resources one input may use are limited to a base amount
+// plus an amount per input byte: parsing is meant to take linear time and
+// memory, so inputs that exceed the budget are reported as crashes. Both the
+// number of allocations and the bytes allocated are limited; they are only
+// counted if AddressSanitizer is used, otherwise only the time is checked.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "optparse99.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef FUZZ_TIME_BASE
+#define FUZZ_TIME_BASE 0.05 // Seconds of CPU time.
+#endif
+#ifndef FUZZ_TIME_PER_BYTE
+#define FUZZ_TIME_PER_BYTE 0.0001
+#endif
+#ifndef FUZZ_ALLOC_BASE
+#define FUZZ_ALLOC_BASE 65536 // Bytes allocated in total.
+#endif
+#ifndef FUZZ_ALLOC_PER_BYTE
+#define FUZZ_ALLOC_PER_BYTE 256
+#endif
+#ifndef FUZZ_ALLOC_COUNT_BASE
+#define FUZZ_ALLOC_COUNT_BASE 256 // Calls to malloc() and friends.
+#endif
+#ifndef FUZZ_ALLOC_COUNT_PER_BYTE
+#define FUZZ_ALLOC_COUNT_PER_BYTE 1
+#endif
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define FUZZ_COUNT_ALLOCATIONS 1
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define FUZZ_COUNT_ALLOCATIONS 1
+#endif
+
+#if OPTPARSE_C99_INTEGER_TYPES_SUPPORT
+#define LAST_DATA_TYPE DATA_TYPE_UINT64
+#else
+#define LAST_DATA_TYPE DATA_TYPE_BOOL
+#endif
+
+// Stops the fuzzer on a violated expectation, with the input saved as a crash.
+#define EXPECT(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: expectation failed: %s\n", __FILE__, \
+                __LINE__, #condition); \
+            abort(); \
+        } \
+    } while (0)
+
+#if FUZZ_COUNT_ALLOCATIONS
+// Provided by the sanitizer runtime.
+int __sanitizer_install_malloc_and_free_hooks(
+    void (*malloc_hook)(const volatile void *, size_t),
+    void (*free_hook)(const volatile void *));
+
+static size_t allocated;        // Bytes allocated since the current input
+                                // started.
+static size_t allocation_count; // Allocations since the current input
+                                // started.
+
+static void count_allocation(const volatile void *ptr, size_t size)
+{
+    (void) ptr;
+    allocated += size;
+    allocation_count++;
+}
+
+static void ignore_free(const volatile void *ptr)
+{
+    (void) ptr;
+}
+#endif
+
+// The storage of the command tree's options.
+static int verbosity, quiet, silent, number, all;
+static long level;
+static unsigned int count;
+static char *name;
+#if OPTPARSE_FLOATING_POINT_SUPPORT
+static double ratio;
+#endif
+#if OPTPARSE_SUBOPTIONS
+static int key_size, key_fast;
+static char *key_name;
+#endif
+static int operand_count;
+
+// Reads every item of a list, so that sanitizers check the array's bounds, and
+// checks that a sorted list is sorted.
+static void read_int_list(struct optparse_ctx *ctx, void *userdata,
+    size_t size, void *array)
+{
+    (void) ctx;
+    bool sorted = userdata != NULL;
+    int *items = array;
+    for (size_t i = 1; i < size; i++) {
+        EXPECT(!sorted || items[i - 1] <= items[i]);
+    }
+}
+
+static void read_ullong_list(size_t size, unsigned long long *items)
+{
+    unsigned long long sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        sum += items[i];
+    }
+    (void) sum;
+}
+
+static void read_words(size_t size, char **words)
+{
+    for (size_t i = 0; i < size; i++) {
+        EXPECT(words[i] != NULL);
+        (void) strlen(words[i]);
+    }
+}
+
+static void run_cmd(struct optparse_ctx *ctx, void *userdata, int argc,
+    char **argv)
+{
+    (void) ctx;
+    (void) userdata;
+    for (int i = 0; i < argc; i++) {
+        EXPECT(argv[i] != NULL);
+    }
+    operand_count = argc;
+}
+
+static struct optparse_opt sub_options[] = {
+    {
+        .short_name = 'a',
+        .long_name = "all",
+        .flag = &all,
+    },
+    {
+        .short_name = 'c',
+        .long_name = "count",
+        .arg_name = "N",
+        .arg_data_type = DATA_TYPE_UINT,
+        .arg_storage = &count,
+    },
+    { END_OF_OPTIONS },
+};
+
+static struct optparse_opt main_options[] = {
+    {
+        .short_name = 'v',
+        .long_name = "verbose",
+        .flag = &verbosity,
+        .flag_type = FLAG_TYPE_INCREMENT,
+    },
+    {
+        .short_name = 'q',
+        .long_name = "quiet",
+        .flag = &quiet,
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+        .group = 1,
+#endif
+    },
+    {
+        .short_name = 's',
+        .long_name = "silent",
+        .flag = &silent,
+#if OPTPARSE_MUTUALLY_EXCLUSIVE_OPTIONS
+        .group = 1,
+#endif
+    },
+    {
+        .short_name = 'n',
+        .long_name = "number",
+#if OPTPARSE_OPTION_ALIASES
+        .short_aliases = "N",
+        .long_aliases = (char *[]) { "num", NULL },
+#endif
+        .arg_name = "N",
+        .arg_data_type = DATA_TYPE_INT,
+        .arg_storage = &number,
+    },
+    {
+        .short_name = 'o',
+        .long_name = "level",
+        .arg_name = "[LEVEL]",
+        .arg_data_type = DATA_TYPE_LONG,
+        .arg_storage = &level,
+    },
+#if OPTPARSE_FLOATING_POINT_SUPPORT
+    {
+        .short_name = 'r',
+        .long_name = "ratio",
+        .arg_name = "X",
+        .arg_data_type = DATA_TYPE_DBL,
+        .arg_storage = &ratio,
+    },
+#endif
+    {
+        .short_name = 'l',
+        .long_name = "list",
+        .arg_name = "LIST",
+        .arg_delim = ",",
+        .arg_data_type = DATA_TYPE_INT,
+        .function = (void (*)(void)) read_int_list,
+        .function_type = FUNCTION_TYPE_CTX_TARG_ARRAY,
+    },
+    {
+        .short_name = 'S',
+        .long_name = "sorted",
+        .arg_name = "LIST",
+        .arg_delim = ",",
+        .arg_data_type = DATA_TYPE_INT,
+        .arg_sorted = true,
+        .function = (void (*)(void)) read_int_list,
+        .function_type = FUNCTION_TYPE_CTX_TARG_ARRAY,
+        .userdata = "sorted",
+    },
+    {
+        .short_name = 'u',
+        .long_name = "unsigned",
+        .arg_name = "LIST",
+        .arg_delim = ",:",
+        .arg_data_type = DATA_TYPE_ULLONG,
+        .function = (void (*)(void)) read_ullong_list,
+        .function_type = FUNCTION_TYPE_TARG_ARRAY,
+    },
+    {
+        .short_name = 'w',
+        .long_name = "words",
+        .arg_name = "WORDS",
+        .arg_delim = ",",
+        .arg_data_type = DATA_TYPE_LONG,
+        .function = (void (*)(void)) read_words,
+        .function_type = FUNCTION_TYPE_OARG_ARRAY,
+    },
+    {
+        .long_name = "name",
+        .arg_name = "NAME",
+        .arg_storage = &name,
+    },
+#if OPTPARSE_SUBOPTIONS
+    {
+        .short_name = 'k',
+        .long_name = "keys",
+        .arg_name = "KEYS",
+        .suboptions = (struct optparse_subopt[]) {
+            {
+                .name = "size",
+                .data_type = DATA_TYPE_INT,
+                .storage = &key_size,
+            },
+            {
+                .name = "name",
+                .storage = &key_name,
+            },
+            {
+                .name = "fast",
+                .flag = &key_fast,
+            },
+            { END_OF_SUBOPTIONS },
+        },
+    },
+#endif
+    { END_OF_OPTIONS },
+};
+
+static struct optparse_cmd main_cmd = {
+    .name = "fuzz",
+    .options = main_options,
+    .subcommands = (struct optparse_cmd[]) {
+        {
+            .name = "sub",
+            .operands = "[FILE...]",
+            .options = sub_options,
+            .ctx_function = run_cmd,
+        },
+        {
+            .name = "deep",
+            .subcommands = (struct optparse_cmd[]) {
+                {
+                    .name = "leaf",
+                    .operands = "[ARG...]",
+                    .options = sub_options,
+                    .ctx_function = run_cmd,
+                },
+                { END_OF_SUBCOMMANDS },
+            },
+        },
+        { END_OF_SUBCOMMANDS },
+    },
+};
+
+// Parses the arguments as a command line.
+static void fuzz_parse(int argc, char **argv)
+{
+    struct optparse_ctx ctx = { .collect_errors = true };
+    int original_argc = argc;
+    operand_count = -1;
+
+    optparse_parse_r(&ctx, &main_cmd, &argc, &argv);
+
+    EXPECT(argc >= 0 && argc <= original_argc);
+    for (int i = 0; i < argc; i++) {
+        EXPECT(argv[i] != NULL);
+    }
+    // Only the first OPTPARSE_DIAGNOSTICS_MAX errors are stored.
+    for (size_t i = 0; i < ctx.diagnostic_count
+            && i < OPTPARSE_DIAGNOSTICS_MAX; i++) {
+        EXPECT(ctx.diagnostics[i].arg_index >= 0
+            && ctx.diagnostics[i].arg_index < original_argc);
+    }
+    optparse_ctx_free(&ctx);
+}
+
+// Converts each argument to each data type, one by one and in bulk.
+static void fuzz_convert(int argc, char **argv,
+    const struct optparse_slice *slices, void *buffer)
+{
+    for (int type = DATA_TYPE_STR; type <= LAST_DATA_TYPE; type++) {
+        size_t error_index = 0;
+        for (int i = 0; i < argc; i++) {
+            union {
+                long double ld;
+                unsigned long long ull;
+                char *str;
+            } value;
+            int ret = strtox(argv[i], &value, type);
+            EXPECT(ret >= -1 && ret <= 1);
+        }
+
+        int ret = strtox_array(argv, argc, buffer, type, &error_index);
+        EXPECT(ret == 0 || (size_t) error_index < (size_t) argc);
+        ret = strtox_slices(slices, argc, buffer, type, &error_index);
+        EXPECT(ret == 0 || (size_t) error_index < (size_t) argc);
+        EXPECT(type != DATA_TYPE_STR || argc == 0 || ret == 1);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    // Compile before measuring, as that is only done once.
+    optparse_compile(&main_cmd);
+
+#if FUZZ_COUNT_ALLOCATIONS
+    static bool hooked;
+    if (!hooked) {
+        __sanitizer_install_malloc_and_free_hooks(count_allocation,
+            ignore_free);
+        hooked = true;
+    }
+    allocated = 0;
+    allocation_count = 0;
+#endif
+    clock_t start = clock();
+
+    // The arguments are parsed in place and split into lists, so they are
+    // copied from the input. The original input provides slices.
+    char *args = malloc(size + 1);
+    char **argv = malloc((size + 2) * sizeof (char *));
+    struct optparse_slice *slices = malloc((size + 1)
+        * sizeof (struct optparse_slice));
+    void *buffer = malloc((size + 1) * sizeof (long double));
+    EXPECT(args && argv && slices && buffer);
+    memcpy(args, data, size);
+    args[size] = '\0';
+
+    int argc = 0;
+    argv[argc++] = main_cmd.name;
+    char *arg = args;
+    for (size_t i = 0; i <= size; i++) {
+        if (args[i] == '\n' || args[i] == '\0') {
+            args[i] = '\0';
+            slices[argc - 1] = (struct optparse_slice) {
+                .str = (const char *) data + (arg - args),
+                .length = (size_t) (args + i - arg),
+            };
+            argv[argc++] = arg;
+            arg = args + i + 1;
+        }
+    }
+    argv[argc] = NULL;
+
+    // Conversion first, as parsing rearranges and splits the arguments.
+    fuzz_convert(argc - 1, argv + 1, slices, buffer);
+    fuzz_parse(argc, argv);
+
+    free(buffer);
+    free(slices);
+    free(argv);
+    free(args);
+
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+    EXPECT(seconds <= FUZZ_TIME_BASE + FUZZ_TIME_PER_BYTE * size);
+#if FUZZ_COUNT_ALLOCATIONS
+    EXPECT(allocated <= FUZZ_ALLOC_BASE + FUZZ_ALLOC_PER_BYTE * size);
+    EXPECT(allocation_count <= FUZZ_ALLOC_COUNT_BASE
+        + FUZZ_ALLOC_COUNT_PER_BYTE * size);
+#endif
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+// Reads a whole stream into dynamically allocated memory.
+static uint8_t *read_stream(FILE *stream, size_t *size)
+{
+    size_t capacity = 4096;
+    uint8_t *data = malloc(capacity);
+    *size = 0;
+    while (data) {
+        *size += fread(data + *size, 1, capacity - *size, stream);
+        if (ferror(stream)) {
+            free(data);
+            return NULL;
+        }
+        if (*size < capacity) {
+            return data;
+        }
+        uint8_t *new_data = realloc(data, capacity *= 2);
+        if (new_data == NULL) {
+            free(data);
+        }
+        data = new_data;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc || i == 1; i++) {
+        FILE *stream = i < argc ? fopen(argv[i], "rb") : stdin;
+        if (stream == NULL) {
+            fprintf(stderr, "Cannot open file: \"%s\"\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+
+        size_t size;
+        uint8_t *data = read_stream(stream, &size);
+        if (stream != stdin) {
+            fclose(stream);
+        }
+        if (data == NULL) {
+            fprintf(stderr, "Cannot read input.\n");
+            return EXIT_FAILURE;
+        }
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+    return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,395 @@
+// Regression tests for parsing behavior that has been broken before. Each test
+// prints its name if it fails; the exit status is the number of failed tests.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "optparse99.h"
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int failures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, \
+                __LINE__, __func__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+#if OPTPARSE_SUBCOMMANDS
+// argv stays NULL-terminated after descending into a subcommand, whose own
+// window is smaller than the one passed to the parsing function.
+static void test_subcommand_argv_terminated(void)
+{
+    struct optparse_cmd cmd = {
+        .name = "prog",
+        .subcommands = (struct optparse_cmd[]) {
+            { .name = "sub" },
+            { END_OF_SUBCOMMANDS },
+        },
+    };
+    char *args[] = { "prog", "sub", "a", "b", NULL };
+    int argc = 4;
+    char **argv = args;
+    struct optparse_ctx ctx = { 0 };
+    optparse_parse_r(&ctx, &cmd, &argc, &argv);
+
+    CHECK(argc == 3);
+    CHECK(strcmp(argv[1], "a") == 0 && strcmp(argv[2], "b") == 0);
+    CHECK(argv[3] == NULL);
+    optparse_ctx_free(&ctx);
+    optparse_free(&cmd);
+}
+#endif
+
+// A window into a larger array is not terminated past its end.
+static void test_window_not_terminated(void)
+{
+    struct optparse_cmd cmd = { .name = "prog" };
+    char *args[] = { "prog", "a", "next" };
+    int argc = 2;
+    char **argv = args;
+    struct optparse_ctx ctx = { 0 };
+    optparse_parse_r(&ctx, &cmd, &argc, &argv);
+
+    CHECK(argc == 2);
+    CHECK(strcmp(args[2], "next") == 0);
+    optparse_ctx_free(&ctx);
+    optparse_free(&cmd);
+}
+
+static FILE *help_stream;
+
+static void print_usage_during_parse(void)
+{
+    optparse_fprint_usage(help_stream);
+    optparse_fprint_help(help_stream, EXIT_SUCCESS, true);
+}
+
+// The help functions without a context parameter can be called while parsing
+// with optparse_parse_r(), which leaves the global context unused.
+static void test_help_during_parse_r(void)
+{
+    struct optparse_cmd cmd = {
+        .name = "prog",
+        .options = (struct optparse_opt[]) {
+            {
+                .short_name = 'u',
+                .function = print_usage_during_parse,
+            },
+            { END_OF_OPTIONS },
+        },
+    };
+    char *args[] = { "prog", "-u", NULL };
+    int argc = 2;
+    char **argv = args;
+    struct optparse_ctx ctx = { 0 };
+    help_stream = tmpfile();
+    CHECK(help_stream != NULL);
+    if (help_stream == NULL) {
+        return;
+    }
+    optparse_parse_r(&ctx, &cmd, &argc, &argv);
+
+    CHECK(ftell(help_stream) > 0);
+    fclose(help_stream);
+
+    // After parsing, the _r variants still print the command's help.
+    help_stream = tmpfile();
+    if (help_stream) {
+        optparse_fprint_usage_r(&ctx, help_stream);
+        CHECK(ftell(help_stream) > 0);
+        fclose(help_stream);
+    }
+    optparse_ctx_free(&ctx);
+    optparse_free(&cmd);
+}
+
+// strtox_slices() can't store strings, as they would point to temporary
+// copies.
+static void test_strtox_slices_rejects_strings(void)
+{
+    struct optparse_slice slices[] = { { "ab", 1 }, { "cd", 2 } };
+    char *strs[2];
+    size_t error_index = 1;
+    CHECK(strtox_slices(slices, 2, strs, DATA_TYPE_STR, &error_index) == 1);
+    CHECK(error_index == 0);
+
+    int numbers[2];
+    struct optparse_slice number_slices[] = { { "12", 1 }, { "34", 2 } };
+    CHECK(strtox_slices(number_slices, 2, numbers, DATA_TYPE_INT, NULL) == 0);
+    CHECK(numbers[0] == 1 && numbers[1] == 34);
+}
+
+#if OPTPARSE_REPL && OPTPARSE_SUBCOMMANDS
+static int provider_calls;
+static bool sub_ran;
+static FILE *null_stream;
+
+static void run_sub(int argc, char **argv)
+{
+    (void) argc;
+    (void) argv;
+    sub_ran = true;
+}
+
+// Ends the first REPL line it is called in by printing help.
+static void provide_sub_once(struct optparse_cmd *cmd)
+{
+    if (++provider_calls == 1) {
+        optparse_fprint_help(null_stream, EXIT_FAILURE, false);
+    }
+    cmd->function = run_sub;
+}
+
+// A provider that ends a REPL line is called again the next time its command
+// is selected, instead of leaving the command half-loaded.
+static void test_repl_provider_aborted(void)
+{
+    struct optparse_cmd cmd = {
+        .name = "prog",
+        .subcommands = (struct optparse_cmd[]) {
+            { .name = "sub", .provider = provide_sub_once },
+            { END_OF_SUBCOMMANDS },
+        },
+    };
+    null_stream = fopen("/dev/null", "w");
+    FILE *stream = tmpfile();
+    if (null_stream == NULL || stream == NULL) {
+        CHECK(!"fopen() failed");
+        return;
+    }
+    fputs("sub\nsub\n", stream);
+    rewind(stream);
+
+    struct optparse_ctx ctx = { 0 };
+    CHECK(optparse_repl_r(&ctx, &cmd, stream, NULL) == 0);
+    CHECK(provider_calls == 2);
+    CHECK(sub_ran);
+    fclose(stream);
+    fclose(null_stream);
+    optparse_ctx_free(&ctx);
+    optparse_free(&cmd);
+}
+#endif
+
+#if OPTPARSE_CANONICAL_ARGV && OPTPARSE_SUBOPTIONS
+// The canonical command line contains the whole option-argument of an option
+// with sub-options, which is split at ',' and '=' while parsing.
+static void test_canonical_suboptions(void)
+{
+    char *type = NULL;
+    char *src = NULL;
+    int ro = 0;
+    struct optparse_cmd cmd = {
+        .name = "prog",
+        .options = (struct optparse_opt[]) {
+            {
+                .short_name = 'm',
+                .arg_name = "MOUNT",
+                .suboptions = (struct optparse_subopt[]) {
+                    { .name = "type", .storage = &type },
+                    { .name = "src", .storage = &src },
+                    { .name = "ro", .flag = &ro },
+                    { END_OF_SUBOPTIONS },
+                },
+            },
+            { END_OF_OPTIONS },
+        },
+    };
+    char arg[] = "type=bind,src=/a,ro";
+    char *args[] = { "prog", "-m", arg, NULL };
+    int argc = 3;
+    char **argv = args;
+    struct optparse_ctx ctx = { 0 };
+    optparse_parse_r(&ctx, &cmd, &argc, &argv);
+    CHECK(type && strcmp(type, "bind") == 0 && src && strcmp(src, "/a") == 0
+        && ro == 1);
+
+    void *buffer[64];
+    int canonical_argc;
+    char **canonical_argv;
+    CHECK(optparse_canonical_argv_r(&ctx, buffer, sizeof buffer,
+        &canonical_argc, &canonical_argv) <= sizeof buffer);
+    // The option-argument may be attached to the option or not.
+    const char *spec = "type=bind,src=/a,ro";
+    bool found = false;
+    for (int i = 1; i < canonical_argc; i++) {
+        char *match = strstr(canonical_argv[i], spec);
+        found = found || (match && strcmp(match, spec) == 0);
+    }
+    CHECK(found);
+    optparse_ctx_free(&ctx);
+    optparse_free(&cmd);
+}
+#endif
+
+#if OPTPARSE_CONVERSION_CACHE
+// Removes a directory and the files in it.
+static void remove_dir(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir) {
+        struct dirent *entry;
+        char file[512];
+        while ((entry = readdir(dir))) {
+            if (entry->d_name[0] != '.') {
+                snprintf(file, sizeof file, "%s/%s", path, entry->d_name);
+                remove(file);
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(path);
+}
+#endif
+
+#if OPTPARSE_CONVERSION_CACHE && OPTPARSE_COLLECT_ERRORS
+// A list that could not be converted is not cached, so it is reported again
+// when it is parsed a second time.
+static void test_invalid_list_not_cached(void)
+{
+    int *ids = NULL;
+    size_t id_count = 0;
+    struct optparse_cmd cmd = {
+        .name = "prog",
+        .options = (struct optparse_opt[]) {
+            {
+                .short_name = 'i',
+                .arg_name = "IDS",
+                .arg_data_type = DATA_TYPE_INT,
+                .arg_delim = ",",
+                .arg_storage = &ids,
+                .arg_storage_size = &id_count,
+            },
+            { END_OF_OPTIONS },
+        },
+    };
+    char cache_dir[] = "/tmp/optparse99_regress_XXXXXX";
+    if (mkdtemp(cache_dir) == NULL) {
+        CHECK(!"mkdtemp() failed");
+        return;
+    }
+
+    // A list long enough to be cached, whose last item is not valid.
+    size_t items = OPTPARSE_CONVERSION_CACHE_MIN_SIZE / 2;
+    char *list = malloc(items * 2 + sizeof "bad");
+    for (size_t i = 0; i < items; i++) {
+        memcpy(list + i * 2, "1,", 2);
+    }
+    strcpy(list + items * 2, "bad");
+
+    for (int run = 0; run < 2; run++) {
+        char *arg = strdup(list);
+        char *args[] = { "prog", "-i", arg, NULL };
+        int argc = 3;
+        char **argv = args;
+        struct optparse_ctx ctx = { .collect_errors = true,
+            .cache_dir = cache_dir };
+        optparse_parse_r(&ctx, &cmd, &argc, &argv);
+        CHECK(ctx.diagnostic_count == 1);
+        CHECK(id_count == 0);
+        optparse_ctx_free(&ctx);
+        free(arg);
+    }
+    free(list);
+    remove_dir(cache_dir);
+    optparse_free(&cmd);
+}
+#endif
+
+#if OPTPARSE_CONVERSION_CACHE && OPTPARSE_REPL && defined(__linux__)
+// Returns the number of mappings of files in a directory.
+static int count_mappings(const char *dir)
+{
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps == NULL) {
+        return -1;
+    }
+    int count = 0;
+    char line[1024];
+    while (fgets(line, sizeof line, maps)) {
+        count += strstr(line, dir) != NULL;
+    }
+    fclose(maps);
+    return count;
+}
+
+// A REPL unmaps the cached lists of a line before reading the next one, so
+// that the number of mappings doesn't grow with the number of lines.
+static void test_repl_releases_cache_maps(void)
+{
+    int *ids = NULL;
+    size_t id_count = 0;
+    struct optparse_cmd cmd = {
+        .name = "prog",
+        .options = (struct optparse_opt[]) {
+            {
+                .short_name = 'i',
+                .arg_name = "IDS",
+                .arg_data_type = DATA_TYPE_INT,
+                .arg_delim = ",",
+                .arg_storage = &ids,
+                .arg_storage_size = &id_count,
+            },
+            { END_OF_OPTIONS },
+        },
+    };
+    char cache_dir[] = "/tmp/optparse99_regress_XXXXXX";
+    FILE *stream = tmpfile();
+    if (mkdtemp(cache_dir) == NULL || stream == NULL) {
+        CHECK(!"mkdtemp() or tmpfile() failed");
+        return;
+    }
+
+    // The same list, long enough to be cached, on every line.
+    size_t items = OPTPARSE_CONVERSION_CACHE_MIN_SIZE / 2 + 1;
+    for (int line = 0; line < 20; line++) {
+        fputs("-i ", stream);
+        for (size_t i = 0; i < items; i++) {
+            fputs(i ? ",1" : "1", stream);
+        }
+        fputc('\n', stream);
+    }
+    rewind(stream);
+
+    struct optparse_ctx ctx = { .cache_dir = cache_dir };
+    CHECK(optparse_repl_r(&ctx, &cmd, stream, NULL) == 0);
+    CHECK(id_count == items);
+    CHECK(count_mappings(cache_dir) == 0);
+    optparse_ctx_free(&ctx);
+    fclose(stream);
+    remove_dir(cache_dir);
+    optparse_free(&cmd);
+}
+#endif
+
+int main(void)
+{
+    test_help_during_parse_r();
+#if OPTPARSE_SUBCOMMANDS
+    test_subcommand_argv_terminated();
+#endif
+    test_window_not_terminated();
+    test_strtox_slices_rejects_strings();
+#if OPTPARSE_REPL && OPTPARSE_SUBCOMMANDS
+    test_repl_provider_aborted();
+#endif
+#if OPTPARSE_CANONICAL_ARGV && OPTPARSE_SUBOPTIONS
+    test_canonical_suboptions();
+#endif
+#if OPTPARSE_CONVERSION_CACHE && OPTPARSE_COLLECT_ERRORS
+    test_invalid_list_not_cached();
+#endif
+#if OPTPARSE_CONVERSION_CACHE && OPTPARSE_REPL && defined(__linux__)
+    test_repl_releases_cache_maps();
+#endif
+    return failures;
+}
@@ -0,0 +1,126 @@
+// Measures the cost of starting short-lived programs that parse their command
+// line with optparse99: spawns each of the given programs repeatedly and
+// reports the latency percentiles, minor page faults and maximum resident set
+// size of the runs. The programs are built from startup_child.c, for command
+// trees of several sizes, linked with optparse99 statically and dynamically.
+//
+// Usage: optparse99_startup RUNS PROGRAM...
+
+#define _DEFAULT_SOURCE
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+
+extern char **environ;
+
+struct sample {
+    double latency;     // In microseconds.
+    long minor_faults;
+    long max_rss;       // In kilobytes.
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Spawns a program and waits for it. Returns 0 on success.
+static int spawn_program(char *path, struct sample *sample)
+{
+    char *argv[] = { path, NULL };
+    double start = now();
+    pid_t pid;
+    if (posix_spawn(&pid, path, NULL, NULL, argv, environ) != 0) {
+        fprintf(stderr, "Couldn't spawn %s.\n", path);
+        return 1;
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        return 1;
+    }
+    sample->latency = now() - start;
+    sample->minor_faults = usage.ru_minflt;
+    sample->max_rss = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "%s failed.\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+static int compare_latencies(const void *a, const void *b)
+{
+    double x = ((const struct sample *) a)->latency;
+    double y = ((const struct sample *) b)->latency;
+    return (x > y) - (x < y);
+}
+
+// Returns the p-th percentile of the sorted samples (nearest rank).
+static double percentile(const struct sample *samples, int count, int p)
+{
+    int rank = (p * count + 99) / 100;
+    return samples[rank > 0 ? rank - 1 : 0].latency;
+}
+
+// Measures one program. Returns 0 on success.
+static int measure(char *path, struct sample *samples, int runs)
+{
+    // Warm up the page cache and the dynamic loader's caches first.
+    struct sample warmup;
+    if (spawn_program(path, &warmup)) {
+        return 1;
+    }
+
+    long minor_faults = 0;
+    long max_rss = 0;
+    for (int i = 0; i < runs; i++) {
+        if (spawn_program(path, &samples[i])) {
+            return 1;
+        }
+        minor_faults += samples[i].minor_faults;
+        if (samples[i].max_rss > max_rss) {
+            max_rss = samples[i].max_rss;
+        }
+    }
+    qsort(samples, runs, sizeof (struct sample), compare_latencies);
+
+    const char *name = strrchr(path, '/');
+    printf("%-32s %8.0f %8.0f %8.0f %8.1f %8ld\n", name ? name + 1 : path,
+        percentile(samples, runs, 50), percentile(samples, runs, 90),
+        percentile(samples, runs, 99), (double) minor_faults / runs, max_rss);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int runs = argc > 2 ? atoi(argv[1]) : 0;
+    if (runs < 1) {
+        fprintf(stderr, "Usage: %s RUNS PROGRAM...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    struct sample *samples = calloc(runs, sizeof (struct sample));
+    if (samples == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    printf("%d runs each; latencies in us, RSS in kB\n", runs);
+    printf("%-32s %8s %8s %8s %8s %8s\n", "program", "p50", "p90", "p99",
+        "minflt", "max RSS");
+    int status = EXIT_SUCCESS;
+    for (int i = 2; i < argc; i++) {
+        if (measure(argv[i], samples, runs)) {
+            status = EXIT_FAILURE;
+        }
+    }
+    free(samples);
+    return status;
+}
@@ -0,0 +1,36 @@
+// A short-lived program for optparse99_startup: parses a command line with a
+// generated command tree of STARTUP_OPTION_COUNT options and exits. The exit
+// status tells whether the parse gave the expected result.
+
+#include "optparse99.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Defined in the generated startup_tree_<count>.c. Options with an even index
+// are flags, the others take a long option-argument.
+extern int startup_flags[STARTUP_OPTION_COUNT];
+extern long startup_values[STARTUP_OPTION_COUNT];
+extern struct optparse_opt startup_options[STARTUP_OPTION_COUNT + 1];
+
+static struct optparse_cmd startup_cmd = {
+    .name = "startup",
+    .options = startup_options,
+};
+
+int main(void)
+{
+    // Use the first and the last option that takes an option-argument.
+    int last = (STARTUP_OPTION_COUNT - 1) / 2 * 2 - 1;
+    char option[32];
+    snprintf(option, sizeof option, "--option-%d=7", last);
+    char *args[] = { "startup", "--option-0", option, "operand", NULL };
+    int argc = 4;
+    char **argv = args;
+    optparse_parse(&startup_cmd, &argc, &argv);
+
+    int ok = startup_flags[0] == 1 && startup_values[last] == 7 && argc == 2
+        && strcmp(argv[1], "operand") == 0;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
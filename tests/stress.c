@@ -0,0 +1,366 @@
+// Parses one shared command tree from many threads at once, compares every
+// result with a single-threaded reference parse of the same command line and
+// reports the throughput for each thread count. Build with -fsanitize=thread
+// to check the parsing path for data races.
+//
+// Usage: optparse99_stress [MAX_THREADS [PARSES_PER_THREAD]]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "optparse99.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LINE_COUNT 256      // The number of distinct command lines.
+#define LINE_ARGS_MAX 32    // The maximum number of arguments per line.
+#define LINE_SIZE_MAX 512   // The maximum size of a line's strings.
+#define OPERANDS_SIZE 256
+
+// The outcome of a single parse. Options store their values in it by offset,
+// so that every parse has its own.
+struct result {
+    int verbosity;
+    long level;
+    int *ids;
+    size_t id_count;
+    char *name;
+    int force;
+    int count;
+    char command[8];
+    char operands[OPERANDS_SIZE];
+};
+
+// A command line, as a template that is copied before each parse, because
+// parsing rearranges argv and splits list option-arguments in place.
+struct line {
+    int argc;
+    char *argv[LINE_ARGS_MAX];
+    size_t size;
+    char strings[LINE_SIZE_MAX];
+};
+
+struct worker {
+    pthread_t thread;
+    unsigned long seed;
+    long parses;
+    bool failed;
+};
+
+static struct line lines[LINE_COUNT];
+static struct result references[LINE_COUNT];
+
+// Records which command ran and its operands.
+static void run_cmd(struct optparse_ctx *ctx, void *userdata, int argc,
+    char **argv)
+{
+    struct result *result = ctx->base;
+    snprintf(result->command, sizeof result->command, "%s", (char *) userdata);
+    size_t len = 0;
+    for (int i = 1; i < argc; i++) {
+        len += snprintf(result->operands + len, OPERANDS_SIZE - len, "%s%s",
+            i > 1 ? " " : "", argv[i]);
+    }
+}
+
+static struct optparse_opt sub_options[] = {
+    {
+        .short_name = 'f',
+        .long_name = "force",
+        .flag = OPTPARSE_OFFSET(struct result, force),
+        .storage_type = STORAGE_TYPE_OFFSET,
+    },
+    {
+        .short_name = 'c',
+        .long_name = "count",
+        .arg_name = "N",
+        .arg_data_type = DATA_TYPE_INT,
+        .arg_storage = OPTPARSE_OFFSET(struct result, count),
+        .storage_type = STORAGE_TYPE_OFFSET,
+    },
+    { END_OF_OPTIONS },
+};
+
+// Loads the subcommand's options the first time it is selected, which several
+// threads may do at once.
+static void provide_sub(struct optparse_cmd *cmd)
+{
+    cmd->options = sub_options;
+}
+
+static struct optparse_opt main_options[] = {
+    {
+        .short_name = 'v',
+        .long_name = "verbose",
+        .flag = OPTPARSE_OFFSET(struct result, verbosity),
+        .flag_type = FLAG_TYPE_INCREMENT,
+        .storage_type = STORAGE_TYPE_OFFSET,
+    },
+    {
+        .short_name = 'L',
+        .long_name = "level",
+        .arg_name = "LEVEL",
+        .arg_data_type = DATA_TYPE_LONG,
+        .arg_storage = OPTPARSE_OFFSET(struct result, level),
+        .storage_type = STORAGE_TYPE_OFFSET,
+    },
+    {
+        .short_name = 'i',
+        .long_name = "ids",
+        .arg_name = "IDS",
+        .arg_data_type = DATA_TYPE_INT,
+        .arg_delim = ",",
+        .arg_storage = OPTPARSE_OFFSET(struct result, ids),
+        .arg_storage_size = OPTPARSE_OFFSET(struct result, id_count),
+        .storage_type = STORAGE_TYPE_OFFSET,
+    },
+    {
+        .short_name = 'n',
+        .long_name = "name",
+        .arg_name = "NAME",
+        .arg_storage = OPTPARSE_OFFSET(struct result, name),
+        .storage_type = STORAGE_TYPE_OFFSET,
+    },
+    { END_OF_OPTIONS },
+};
+
+// Two identical trees: the reference tree is parsed on a single thread, the
+// shared one by all threads at once, starting with its provider unloaded.
+static struct optparse_cmd reference_subcommands[] = {
+    { .name = "sub", .provider = provide_sub, .ctx_function = run_cmd,
+        .userdata = "sub" },
+    { END_OF_SUBCOMMANDS },
+};
+static struct optparse_cmd shared_subcommands[] = {
+    { .name = "sub", .provider = provide_sub, .ctx_function = run_cmd,
+        .userdata = "sub" },
+    { END_OF_SUBCOMMANDS },
+};
+static struct optparse_cmd reference_cmd = {
+    .name = "stress",
+    .ctx_function = run_cmd,
+    .userdata = "main",
+    .options = main_options,
+    .subcommands = reference_subcommands,
+};
+static struct optparse_cmd shared_cmd = {
+    .name = "stress",
+    .ctx_function = run_cmd,
+    .userdata = "main",
+    .options = main_options,
+    .subcommands = shared_subcommands,
+};
+
+// A small, thread-safe pseudo-random number generator (xorshift).
+static unsigned long next_random(unsigned long *state)
+{
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x & 0xFFFFFFFFUL;
+    return *state;
+}
+
+static void add_arg(struct line *line, const char *fmt, long value)
+{
+    char *arg = line->strings + line->size;
+    int n = snprintf(arg, LINE_SIZE_MAX - line->size, fmt, value);
+    line->argv[line->argc++] = arg;
+    line->size += n + 1;
+}
+
+// Generates a random, valid command line.
+static void generate_line(struct line *line, unsigned long seed)
+{
+    unsigned long state = seed * 2654435761UL + 1;
+    line->argc = 0;
+    line->size = 0;
+    add_arg(line, "stress", 0);
+
+    // A list stored in .arg_storage is replaced (not freed) if the option is
+    // used again, so --ids is used at most once.
+    bool ids = false;
+    int count = next_random(&state) % 8;
+    for (int i = 0; i < count; i++) {
+        long value = next_random(&state) % 1000;
+        int choice = next_random(&state) % 6;
+        if (choice == 4 && ids) {
+            choice = 0;
+        }
+        switch (choice) {
+            case 0: add_arg(line, "-v", 0); break;
+            case 1: add_arg(line, "--verbose", 0); break;
+            case 2: add_arg(line, "-L%ld", value); break;
+            case 3: add_arg(line, "--level=%ld", -value); break;
+            case 4:
+                add_arg(line, "--ids", 0);
+                add_arg(line, "%ld,7,,-3", value);
+                ids = true;
+                break;
+            case 5: add_arg(line, "--name=n%ld", value); break;
+        }
+    }
+
+    if (next_random(&state) % 2) {
+        add_arg(line, "sub", 0);
+        count = next_random(&state) % 5;
+        for (int i = 0; i < count; i++) {
+            long value = next_random(&state) % 100;
+            switch (next_random(&state) % 3) {
+                case 0: add_arg(line, "-f", 0); break;
+                case 1: add_arg(line, "--count=%ld", value); break;
+                case 2: add_arg(line, "x%ld", value); break;
+            }
+        }
+    }
+}
+
+// Parses a copy of a command line.
+static void parse_line(struct optparse_ctx *ctx, struct optparse_cmd *cmd,
+    const struct line *line, struct result *result)
+{
+    char strings[LINE_SIZE_MAX];
+    char *argv[LINE_ARGS_MAX + 1];
+    memcpy(strings, line->strings, line->size);
+    for (int i = 0; i < line->argc; i++) {
+        argv[i] = strings + (line->argv[i] - line->strings);
+    }
+    argv[line->argc] = NULL;
+
+    int argc = line->argc;
+    char **args = argv;
+    *result = (struct result) { 0 };
+    ctx->base = result;
+    optparse_parse_r(ctx, cmd, &argc, &args);
+
+    // The name points into the copy, which is about to go out of scope.
+    if (result->name) {
+        result->name = strdup(result->name);
+    }
+}
+
+static bool results_equal(const struct result *a, const struct result *b)
+{
+    return a->verbosity == b->verbosity && a->level == b->level
+        && a->id_count == b->id_count
+        && (a->id_count == 0
+            || memcmp(a->ids, b->ids, a->id_count * sizeof (int)) == 0)
+        && (a->name == b->name
+            || (a->name && b->name && strcmp(a->name, b->name) == 0))
+        && a->force == b->force && a->count == b->count
+        && strcmp(a->command, b->command) == 0
+        && strcmp(a->operands, b->operands) == 0;
+}
+
+static void free_result(struct result *result)
+{
+    free(result->ids);
+    free(result->name);
+}
+
+static void *run_worker(void *arg)
+{
+    struct worker *worker = arg;
+    struct optparse_ctx ctx = { 0 };
+    unsigned long state = worker->seed;
+    for (long i = 0; i < worker->parses; i++) {
+        size_t index = next_random(&state) % LINE_COUNT;
+        struct result result;
+        parse_line(&ctx, &shared_cmd, &lines[index], &result);
+        bool equal = results_equal(&result, &references[index]);
+        free_result(&result);
+        if (!equal) {
+            fprintf(stderr, "Result of line %zu differs from the reference.\n",
+                index);
+            worker->failed = true;
+            break;
+        }
+    }
+    optparse_ctx_free(&ctx);
+    return NULL;
+}
+
+// Returns the thread count to measure after count: the next power of 2, or
+// max_count if that is lower, or a value above max_count when done.
+static int next_count(int count, int max_count)
+{
+    if (count < max_count && count * 2 > max_count) {
+        return max_count;
+    }
+    return count * 2;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    long parses = argc > 2 ? atol(argv[2]) : 20000;
+    if (max_threads < 1 || parses < 1) {
+        fprintf(stderr, "Usage: %s [MAX_THREADS [PARSES_PER_THREAD]]\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Compute the reference results on a single thread.
+    struct optparse_ctx ctx = { 0 };
+    for (size_t i = 0; i < LINE_COUNT; i++) {
+        generate_line(&lines[i], i);
+        parse_line(&ctx, &reference_cmd, &lines[i], &references[i]);
+    }
+    optparse_ctx_free(&ctx);
+    optparse_compile(&shared_cmd);
+
+    struct worker *workers = calloc(max_threads, sizeof (struct worker));
+    if (workers == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    double single_rate = 0;
+    int status = EXIT_SUCCESS;
+    for (int threads = 1; threads <= max_threads; threads = next_count(threads,
+            max_threads)) {
+        double start = now();
+        for (int i = 0; i < threads; i++) {
+            workers[i] = (struct worker) { .seed = i + 1, .parses = parses };
+            if (pthread_create(&workers[i].thread, NULL, run_worker,
+                    &workers[i])) {
+                fprintf(stderr, "Couldn't create thread.\n");
+                return EXIT_FAILURE;
+            }
+        }
+        for (int i = 0; i < threads; i++) {
+            pthread_join(workers[i].thread, NULL);
+            if (workers[i].failed) {
+                status = EXIT_FAILURE;
+            }
+        }
+        double seconds = now() - start;
+
+        // Falling short of linear scaling points at remaining contention.
+        double rate = threads * parses / seconds;
+        if (threads == 1) {
+            single_rate = rate;
+        }
+        printf("%3d threads: %10.0f parses/s, %10.0f per thread, "
+            "%5.1f%% of linear scaling\n", threads, rate, rate / threads,
+            100 * rate / (threads * single_rate));
+    }
+
+    for (size_t i = 0; i < LINE_COUNT; i++) {
+        free_result(&references[i]);
+    }
+    free(workers);
+    return status;
+}